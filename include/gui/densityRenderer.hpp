@@ -0,0 +1,32 @@
+#ifndef DENSITYRENDERER_HPP
+#define DENSITYRENDERER_HPP
+
+#include <glad/glad.h>
+#include "gui/shader.hpp"
+
+namespace gui
+{
+    // Draws large point sets as a density field: points are splatted with
+    // additive blending into a float texture at 1/downsample of the screen
+    // resolution, then one full-screen pass tone-maps the texture, so the
+    // cost per frame follows the number of pixels instead of bodies.
+    class DensityRenderer
+    {
+    public:
+        DensityRenderer();
+        void create(int downsample);
+        void destroy();
+        Shader &begin(int width, int height);
+        void end(float exposure);
+
+    private:
+        void resize(int width, int height);
+
+        Shader splatShader, toneMapShader;
+        unsigned int fbo, texture, emptyVAO;
+        int target;
+        int downsample, width, height, textureWidth, textureHeight;
+    };
+}
+
+#endif
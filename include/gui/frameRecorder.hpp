@@ -0,0 +1,61 @@
+#ifndef FRAMERECORDER_HPP
+#define FRAMERECORDER_HPP
+
+#include <glad/glad.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace gui
+{
+    // Renders into an offscreen framebuffer and saves every captured frame as a
+    // binary PPM image. Readbacks alternate between two pixel buffer objects
+    // and each one is only mapped a frame after it was issued, so the copy has
+    // finished by then. The pixels go through a fixed ring of staging buffers
+    // to a writer thread. When every buffer is still waiting for the disk,
+    // capture() waits, so the numbered images have no gaps. A frame is only
+    // dropped if its pixel buffer cannot be mapped.
+    class FrameRecorder
+    {
+    public:
+        FrameRecorder();
+        ~FrameRecorder();
+
+        bool create(int width, int height, const std::string &prefix, int numBuffers);
+        void destroy();
+        void bind();
+        void capture();
+
+        unsigned long long getFramesCaptured() const;
+        unsigned long long getFramesWritten() const;
+        unsigned long long getFramesDropped() const;
+
+    private:
+        struct Frame
+        {
+            unsigned long long index;
+            std::vector<unsigned char> pixels;
+        };
+
+        void queue(unsigned int buffer, unsigned long long index);
+        void writer();
+
+        unsigned int fbo, colorBuffer, depthBuffer, pbo[2];
+        int width, height;
+        unsigned long long framesCaptured;
+        std::string prefix;
+        std::vector<Frame> ring;
+        std::vector<bool> full;
+        int head, tail;
+        std::mutex mutex;
+        std::condition_variable filled, freed;
+        std::thread thread;
+        bool running;
+        std::atomic<unsigned long long> framesWritten, framesDropped;
+    };
+}
+
+#endif
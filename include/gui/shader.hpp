@@ -2,6 +2,7 @@
 #define SHADER_HPP
 
 #include <string>
+#include <cstdint>
 #include <glad/glad.h>
 #include <iostream>
 #include <fstream>
@@ -12,6 +13,11 @@
 
 namespace gui
 {
+    // Linked programs are cached for the life of the process, keyed on their
+    // source paths, so starting a mode again reuses them. With the binary
+    // cache enabled, programs are also stored on disk with glGetProgramBinary,
+    // keyed on a hash of the sources and of the driver strings. Builds with
+    // EMBED_SHADERS read the sources from the executable instead of files.
     class Shader
     {
     public:
@@ -21,9 +27,16 @@ namespace gui
         void destroy();
         void uniform1i(const char *name, const int value);
         void uniform1f(const char *name, const float value);
+        void uniform2f(const char *name, const float x, const float y);
         void uniform4mat(const char *name, const glm::mat4 &value);
+        static void enableBinaryCache(const std::string &directory, GLADloadproc load);
+        static void clearCache();
 
     private:
+        static unsigned int compile(const std::string &vertexSource, const std::string &fragmentSource);
+        static unsigned int loadBinary(const std::string &vertexSource, const std::string &fragmentSource);
+        static void saveBinary(unsigned int program, const std::string &vertexSource, const std::string &fragmentSource);
+        static std::string binaryPath(uint64_t sourceHash);
         std::string readFile(std::string path);
         unsigned int shaderProgram;
     };
@@ -0,0 +1,57 @@
+#ifndef COLLISIONSOLVER_HPP
+#define COLLISIONSOLVER_HPP
+
+#include "simulation/body.hpp"
+#include "simulation/spatialHash.hpp"
+#include "simulation/threadPool.hpp"
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+namespace sim
+{
+    // Finds touching pairs through a SpatialHash with cells of one diameter and
+    // resolves them with restitution impulses. Bodies with index >= movable are
+    // treated as fixed (infinite mass).
+    //
+    // Contacts are greedily coloured so that no movable body appears twice in
+    // the same batch. Batches are resolved one after another and the contacts
+    // inside a batch in parallel, which gives the same result for any number
+    // of threads.
+    //
+    // merge() is the accretion alternative to resolve(): every connected group
+    // of touching bodies becomes one body that conserves mass and momentum,
+    // and the survivors are compacted in place in their original order.
+    class CollisionSolver
+    {
+    public:
+        CollisionSolver(ThreadPool &pool);
+
+        void resolve(std::vector<Body> &bodies, float radius, float restitution, int movable);
+        int merge(std::vector<Body> &bodies, float radius, std::vector<int> &ids);
+        const std::vector<Contact> &getContacts() const;
+        const std::vector<int> &getSurvivors() const;
+        int getNumBatches() const;
+
+    private:
+        void findContacts(const std::vector<Body> &bodies, float radius);
+        void colourContacts(int numBodies, int movable);
+        void resolveContact(Body &a, Body &b, bool bFixed, float radius, float restitution);
+        int findRoot(int i);
+
+        static const int maxColours = 64;
+        static const int parallelThreshold = 256;
+
+        ThreadPool &pool;
+        SpatialHash hash;
+        std::vector<Contact> contacts;
+        std::vector<std::vector<Contact>> chunkContacts;
+        std::vector<uint64_t> usedColours;
+        std::vector<int> colour;
+        std::vector<int> batchStart;
+        std::vector<Contact> batched;
+        std::vector<int> parent, survivors;
+    };
+}
+
+#endif
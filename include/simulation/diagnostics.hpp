@@ -0,0 +1,58 @@
+#ifndef DIAGNOSTICS_HPP
+#define DIAGNOSTICS_HPP
+
+#include "simulation/body.hpp"
+#include "simulation/threadPool.hpp"
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstdio>
+
+namespace sim
+{
+    struct DiagnosticsSample
+    {
+        unsigned long long step;
+        double time;
+        double kinetic, potential;
+        double momentum[3], angularMomentum[3];
+        double virialRatio;
+    };
+
+    // Conservation checks for the tree codes, logged as CSV. step() is called
+    // once per physics step, with the bodies still at the positions the
+    // forces were taken at and the per-unit-mass potentials from the same
+    // tree walk. Every interval steps it reduces the bodies in parallel into
+    // kinetic and potential energy, linear and angular momentum (about the
+    // origin) and the virial ratio 2K / |U|, and appends one line.
+    class Diagnostics
+    {
+    public:
+        Diagnostics(ThreadPool &pool);
+        ~Diagnostics();
+
+        bool start(const std::string &path, int interval);
+        void step(double dt, const std::vector<Body> &bodies, const std::vector<float> &potentials);
+        void stop();
+        bool isRunning() const;
+
+        bool hasSample() const;
+        const DiagnosticsSample &getLatest() const;
+        double getEnergyDrift() const;
+
+    private:
+        void sample(const std::vector<Body> &bodies, const std::vector<float> &potentials);
+
+        ThreadPool &pool;
+        FILE *file;
+        int interval;
+        unsigned long long steps;
+        double time;
+        bool sampled;
+        double initialEnergy;
+        DiagnosticsSample latest;
+        std::mutex mutex;
+    };
+}
+
+#endif
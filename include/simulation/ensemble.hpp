@@ -0,0 +1,60 @@
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+
+#include "simulation/threadPool.hpp"
+#include <vector>
+#include <atomic>
+#include <cmath>
+
+namespace sim
+{
+    struct EnsembleRun
+    {
+        double mass[3];
+        double coord[3][3], veloc[3][3];
+    };
+
+    struct EnsembleResult
+    {
+        double escapeTime;
+        int escaper;
+        double binaryEnergy;
+    };
+
+    // Integrates many independent three-body systems. Runs are grouped into
+    // batches of `lanes` systems stored lane-innermost, so every loop of the
+    // leapfrog step runs across systems and vectorises; batches are spread
+    // over the thread pool. A run ends when one body is unbound from the
+    // other two and farther than escapeDistance from their centre of mass.
+    // escapeTime is negative for runs that did not end within maxTime, in
+    // which case binaryEnergy belongs to the most bound pair at maxTime.
+    class Ensemble
+    {
+    public:
+        Ensemble(ThreadPool &pool);
+
+        void run(int dimension, const std::vector<EnsembleRun> &initial, std::vector<EnsembleResult> &results,
+                 double G, double alpha, double deltaTime, double maxTime, double escapeDistance,
+                 const std::atomic<bool> &cancel);
+
+        static const int lanes = 16;
+
+    private:
+        struct Batch
+        {
+            double mass[3][lanes];
+            double coord[3][3][lanes], veloc[3][3][lanes], accel[3][3][lanes];
+        };
+
+        void runBatch(Batch &batch, EnsembleResult *results, int count);
+        void acceleration(Batch &batch);
+        double pairEnergy(const Batch &batch, int i, int k, int lane) const;
+        int checkEscape(const Batch &batch, int lane) const;
+
+        ThreadPool &pool;
+        int dimension;
+        double G, alphaSqr, deltaTime, maxTime, escapeDistance;
+    };
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+#include "simulation/body.hpp"
+#include "simulation/threadPool.hpp"
+#include <vector>
+#include <cstdint>
+
+namespace sim
+{
+    enum class Distribution
+    {
+        Uniform,
+        Plummer,
+        Hernquist,
+        ExponentialDisk
+    };
+
+    // Generates initial conditions in parallel. Every random number of body i
+    // comes from a counter-based stream keyed on (seed, i), so the output is
+    // bit-identical for a given seed whatever the number of threads.
+    class Generator
+    {
+    public:
+        Generator(ThreadPool &pool);
+
+        void generate(Distribution distribution, int count, int dimension, float scale,
+                      double G, double softening, uint64_t seed, std::vector<Body> &bodies);
+
+    private:
+        ThreadPool &pool;
+    };
+}
+
+#endif
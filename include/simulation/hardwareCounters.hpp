@@ -0,0 +1,42 @@
+#ifndef HARDWARE_COUNTERS_HPP
+#define HARDWARE_COUNTERS_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace sim
+{
+    enum class Counter
+    {
+        Cycles,
+        Instructions,
+        CacheMisses,
+        BranchMisses,
+        Count
+    };
+
+    // CPU performance counters through Linux perf_event_open, in user mode
+    // only. One counter group is opened for every thread of the process that
+    // exists when open() is called, so the thread pool's work is counted
+    // too. read() returns the totals over all of these threads. On other
+    // systems, or when perf events are not allowed, open() fails with a
+    // message and the counters stay closed.
+    class HardwareCounters
+    {
+    public:
+        HardwareCounters();
+        ~HardwareCounters();
+
+        bool open(std::string &error);
+        void close();
+        bool isOpen() const;
+        void read(uint64_t values[(int)Counter::Count]) const;
+
+    private:
+        std::vector<int> leaders;
+        std::vector<int> members;
+    };
+}
+
+#endif
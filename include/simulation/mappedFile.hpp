@@ -0,0 +1,29 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+namespace sim
+{
+    // Read-only view of a whole file: a private mapping where mmap is
+    // available, a heap copy elsewhere. data is nullptr if the file could not
+    // be opened or is empty.
+    class MappedFile
+    {
+    public:
+        MappedFile(const std::string &path);
+        ~MappedFile();
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const char *data;
+        size_t size;
+
+    private:
+        std::vector<char> copy;
+    };
+}
+
+#endif
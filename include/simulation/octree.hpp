@@ -0,0 +1,59 @@
+#ifndef OCTREE_HPP
+#define OCTREE_HPP
+
+#include "simulation/body.hpp"
+#include "simulation/threadPool.hpp"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+
+namespace sim
+{
+    struct OctreeNode
+    {
+        float centre[3], halfSize;
+        float massCentre[3], mass;
+        int firstChild, numChildren;
+        int begin, end;
+    };
+
+    // Flat octree over 3D bodies. Nodes live in one array with the children of
+    // a node stored next to each other, and the bodies are copied in tree order
+    // so every node covers a contiguous range of them.
+    //
+    // accelerations() is a Barnes-Hut walk run in parallel over the bodies.
+    // The same walk also gives each body's potential per unit mass.
+    // cull() walks the same tree for the renderer: cells outside the view
+    // frustum are skipped, cells that look smaller than lodRatio (size over
+    // distance) are emitted as one centre-of-mass point, and the bodies of the
+    // remaining leaves are emitted one by one. Each point is x, y, z followed
+    // by the number of bodies it stands for.
+    class Octree
+    {
+    public:
+        Octree(ThreadPool &pool);
+
+        void build(const std::vector<Body> &bodies, int leafSize);
+        void accelerations(float G, float softening, float theta, std::vector<float> &acc, std::vector<float> &potential) const;
+        void cull(const float planes[6][4], const float eye[3], float lodRatio, std::vector<float> &points);
+        int getVisibleBodies() const;
+        int getAggregatedCells() const;
+        unsigned long long getInteractions() const;
+
+    private:
+        void split(int node, int depth);
+
+        static const int maxDepth = 21;
+
+        ThreadPool &pool;
+        int leafSize;
+        std::vector<OctreeNode> nodes;
+        std::vector<int> order, scratch;
+        std::vector<float> positions, sorted;
+        int visibleBodies, aggregatedCells;
+        mutable std::atomic<unsigned long long> interactions;
+    };
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef PARTICLELOADER_HPP
+#define PARTICLELOADER_HPP
+
+#include "simulation/body.hpp"
+#include "simulation/threadPool.hpp"
+#include <vector>
+#include <string>
+
+namespace sim
+{
+    // Reads initial conditions from a particle file. Text files hold one body
+    // per line as "mass x y [z] vx vy [vz]" separated by commas, semicolons or
+    // whitespace, with an optional header line and '#' comments. Files ending
+    // in ".bin" hold the same values as raw little-endian float32 records.
+    // The file is mapped and split into chunks that are parsed in parallel.
+    class ParticleLoader
+    {
+    public:
+        ParticleLoader(ThreadPool &pool);
+
+        bool load(const std::string &path, int dimension, std::vector<Body> &bodies, std::string &error);
+        double getSeconds() const;
+        double getMegabytesPerSecond() const;
+
+    private:
+        bool loadText(const char *data, size_t size, int dimension, std::vector<Body> &bodies, std::string &error);
+        bool loadBinary(const char *data, size_t size, int dimension, std::vector<Body> &bodies, std::string &error);
+
+        ThreadPool &pool;
+        double seconds, megabytesPerSecond;
+    };
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include "simulation/hardwareCounters.hpp"
+
+namespace sim
+{
+    enum class Phase
+    {
+        TreeBuild,
+        ForceWalk,
+        Collisions,
+        Integration,
+        StagingCopy,
+        Upload,
+        Gui,
+        Swap,
+        Count
+    };
+
+    // Per-phase frame timings for the profiler overlay. A phase may be timed
+    // several times in one frame; the intervals add up, and endFrame() moves
+    // the totals into a rolling history of the last historyLength frames.
+    // Only meant to be used from the render thread. Every timed interval is
+    // also recorded as a trace marker named after its phase. With hardware
+    // counters attached, each interval also adds the counter deltas, summed
+    // over all threads, to its phase.
+    class Profiler
+    {
+    public:
+        Profiler(int historyLength);
+
+        void begin(Phase phase);
+        void end(Phase phase);
+        void addSteps(int steps);
+        void addInteractions(unsigned long long interactions);
+        void addBytesUploaded(unsigned long long bytes);
+        void setCounters(HardwareCounters *counters);
+        void endFrame();
+
+        static const char *getName(Phase phase);
+        const std::vector<float> &getHistory(Phase phase) const;
+        int getHead() const;
+        float getPercentile(Phase phase, float percentile) const;
+        double getStepsPerSecond() const;
+        double getInteractionsPerSecond() const;
+        double getBytesPerFrame() const;
+        double getFrameMilliseconds() const;
+        bool hasCounters() const;
+        double getCounterTotal(Phase phase, Counter counter) const;
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        int historyLength, head, frames;
+        Clock::time_point frameStart;
+        uint64_t started[(int)Phase::Count];
+        double current[(int)Phase::Count];
+        std::vector<float> history[(int)Phase::Count];
+        std::vector<float> frameSeconds;
+        std::vector<double> steps, interactions, bytes;
+        double currentSteps, currentInteractions, currentBytes;
+        HardwareCounters *counters;
+        uint64_t counterStart[(int)Phase::Count][(int)Counter::Count];
+        double currentCounts[(int)Phase::Count][(int)Counter::Count];
+        std::vector<double> counterHistory[(int)Phase::Count][(int)Counter::Count];
+        mutable std::vector<float> sorted;
+    };
+
+    // Times the enclosing block as one interval of a phase.
+    class ProfileScope
+    {
+    public:
+        ProfileScope(Profiler &profiler, Phase phase);
+        ~ProfileScope();
+
+    private:
+        Profiler &profiler;
+        Phase phase;
+    };
+}
+
+#endif
@@ -15,7 +15,7 @@ namespace sim
         ~QuadTree();
 
         void addBody(Body body);
-        std::vector<float> calForce(Body body, float G, float alpha, float theta);
+        std::vector<float> calForce(Body body, float G, float alpha, float theta, unsigned long long &interactions, float &potential);
 
     private:
         int depth;
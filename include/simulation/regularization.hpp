@@ -0,0 +1,50 @@
+#ifndef REGULARIZATION_HPP
+#define REGULARIZATION_HPP
+
+#include "simulation/body.hpp"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+namespace sim
+{
+    // Algorithmic (logH) regularization for small systems. While any pair is
+    // closer than encounterDistance the whole system is advanced with the
+    // time-transformed leapfrog of Mikkola & Tanikawa (dt = ds / U), which
+    // follows close encounters without softening or a collapsing time step.
+    //
+    // advance() takes at most maxIterations sub-steps. When that cap stops it
+    // short of deltaTime, up to one more deltaTime of the missing time is
+    // carried into the next call and anything beyond is counted as lost, as
+    // is a carry still left when endEncounter() is called. reset() clears the
+    // carry and the counters for a new run.
+    class Regularization
+    {
+    public:
+        Regularization(double G, double encounterDistance, int subSteps);
+
+        bool closeEncounter(const std::vector<Body> &bodies) const;
+        void advance(std::vector<Body> &bodies, double deltaTime);
+        void endEncounter();
+        void reset();
+
+        int getCappedSteps() const;
+        double getShortfall() const;
+        double getLostTime() const;
+
+    private:
+        double kineticEnergy() const;
+        double potentialEnergy() const;
+        void acceleration();
+        void drift(double dt);
+
+        double G, encounterDistance;
+        int subSteps, maxIterations;
+        int n, dimension;
+        int cappedSteps;
+        double shortfall, lostTime;
+        std::vector<double> mass, coord, veloc, accel;
+    };
+}
+
+#endif
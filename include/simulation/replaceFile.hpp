@@ -0,0 +1,14 @@
+#ifndef REPLACEFILE_HPP
+#define REPLACEFILE_HPP
+
+#include <string>
+
+namespace sim
+{
+    // Moves a finished temporary file over path, replacing any file already
+    // there. std::rename does this on POSIX but fails on Windows when the
+    // target exists, which would leave every later save stuck on the first.
+    bool replaceFile(const std::string &tmpPath, const std::string &path);
+}
+
+#endif
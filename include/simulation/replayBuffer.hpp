@@ -0,0 +1,50 @@
+#ifndef REPLAYBUFFER_HPP
+#define REPLAYBUFFER_HPP
+
+#include "simulation/body.hpp"
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <cstddef>
+
+namespace sim
+{
+    // Compressed history of body positions. Positions are quantised to 16
+    // bits inside the bounding cell of the frame group (the root cell a tree
+    // would use, with a margin) and every frame after a keyframe stores only
+    // the zigzag varint delta to the previous frame. Whole groups are evicted
+    // from the front once the memory budget is exceeded.
+    class ReplayBuffer
+    {
+    public:
+        ReplayBuffer(size_t memoryBudget, int keyframeInterval);
+
+        void clear();
+        void push(const std::vector<Body> &bodies, int dimension);
+        int decode(int frame, std::vector<float> &coords, float scale);
+
+        int size() const;
+        size_t getMemoryUsed() const;
+        double getCompressionRatio() const;
+
+    private:
+        struct Frame
+        {
+            bool keyframe;
+            int count, dimension;
+            float origin[3], step[3];
+            std::vector<uint8_t> bytes;
+        };
+
+        void encodeKeyframe(Frame &frame, const std::vector<Body> &bodies);
+        void evict();
+
+        std::deque<Frame> frames;
+        std::vector<uint16_t> lastQuantised, cachedQuantised;
+        int cachedFrame;
+        size_t memoryBudget, memoryUsed, rawBytes;
+        int keyframeInterval, sinceKeyframe;
+    };
+}
+
+#endif
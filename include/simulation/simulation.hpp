@@ -9,7 +9,9 @@ namespace sim
         NBodyBig,
         NBodySmall,
         TwoFixedBody,
-        ThreeBody3D
+        ThreeBody3D,
+        Tracers,
+        NBodyBig3D
     };
     enum class States
     {
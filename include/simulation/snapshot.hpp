@@ -0,0 +1,31 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "simulation/body.hpp"
+#include "simulation/threadPool.hpp"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace sim
+{
+    // Binary snapshot of the simulation state. A fixed header is followed by
+    // one block per array (masses, each coordinate, each velocity component,
+    // body ids), every block with its own CRC-32. Files are written to a
+    // temporary name and renamed into place, so a crash never leaves a
+    // half-written snapshot, and are read through mmap where available.
+    struct SnapshotInfo
+    {
+        int option, dimension;
+        float radius, restitution;
+        bool trail, walls, collisions, merging;
+    };
+
+    bool saveSnapshot(const std::string &path, const SnapshotInfo &info,
+                      const std::vector<Body> &bodies, const std::vector<int> &ids);
+    bool loadSnapshot(ThreadPool &pool, const std::string &path, SnapshotInfo &info,
+                      std::vector<Body> &bodies, std::vector<int> &ids, std::string &error);
+    uint32_t crc32(const void *data, size_t size, uint32_t crc = 0);
+}
+
+#endif
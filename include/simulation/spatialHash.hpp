@@ -0,0 +1,39 @@
+#ifndef SPATIALHASH_HPP
+#define SPATIALHASH_HPP
+
+#include "simulation/body.hpp"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+namespace sim
+{
+    struct Contact
+    {
+        int i, k;
+    };
+
+    // Uniform grid hashed into a power-of-two table. Bodies are bucketed with a
+    // counting sort, so a rebuild is O(n) and does not allocate once the
+    // buffers have grown to the body count.
+    class SpatialHash
+    {
+    public:
+        SpatialHash();
+
+        void build(const std::vector<Body> &bodies, float cellSize);
+        void findContacts(const std::vector<Body> &bodies, float radius, std::vector<Contact> &contacts) const;
+        void findContacts(const std::vector<Body> &bodies, float radius, int begin, int end, std::vector<Contact> &contacts) const;
+
+    private:
+        long long cellOf(float coord) const;
+        unsigned int hashCell(long long x, long long y, long long z) const;
+
+        float cellSize;
+        unsigned int mask;
+        std::vector<int> cellStart, cellCursor, cellBodies;
+        std::vector<unsigned int> bodyHash;
+    };
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef STABILITYMAP_HPP
+#define STABILITYMAP_HPP
+
+#include "simulation/body.hpp"
+#include "simulation/threadPool.hpp"
+#include <vector>
+#include <string>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <fstream>
+
+namespace sim
+{
+    // Finite-time Lyapunov exponents over a grid of starting positions for
+    // one body of a 2D system. Every grid point integrates the orbit with a
+    // leapfrog together with its tangent map (the variational equations of
+    // the same leapfrog), renormalising the tangent vector as it grows. Rows
+    // of the grid are spread over the thread pool. Bodies with index >=
+    // movable stay fixed, as in the TwoFixedBody mode.
+    class StabilityMap
+    {
+    public:
+        StabilityMap(ThreadPool &pool);
+
+        void compute(const std::vector<Body> &bodies, int movable, int varied,
+                     float xMin, float xMax, float yMin, float yMax, int width, int height,
+                     double G, double alpha, double deltaTime, double duration,
+                     const std::atomic<bool> &cancel);
+        const std::vector<float> &getExponents() const;
+        bool writeImage(const std::string &path) const;
+        bool writeRaw(const std::string &path) const;
+
+    private:
+        float exponent(std::vector<double> &coord, std::vector<double> &veloc) const;
+        void acceleration(const std::vector<double> &coord, const std::vector<double> &tangent,
+                          std::vector<double> &accel, std::vector<double> &tangentAccel) const;
+
+        ThreadPool &pool;
+        int width, height, n, movable;
+        double G, alphaSqr, deltaTime, duration;
+        std::vector<double> mass;
+        std::vector<float> exponents;
+    };
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+namespace sim
+{
+    // Fixed set of worker threads for data-parallel loops. parallelFor splits
+    // [0, count) into chunks that the workers and the calling thread pull from
+    // a shared counter, and returns once every chunk has been processed.
+    class ThreadPool
+    {
+    public:
+        ThreadPool();
+        ThreadPool(int numThreads);
+        ~ThreadPool();
+
+        int size() const;
+        void parallelFor(int count, const std::function<void(int begin, int end)> &task);
+
+    private:
+        void start(int numThreads);
+        void worker();
+        void runChunks();
+
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake, done;
+        const std::function<void(int, int)> *task;
+        int count, chunkSize;
+        std::atomic<int> nextChunk;
+        int busy;
+        unsigned long long generation;
+        bool stop;
+    };
+}
+
+#endif
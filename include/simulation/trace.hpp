@@ -0,0 +1,35 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+#include <cstdint>
+
+namespace sim
+{
+    // Timeline markers in Chrome's trace event format, for chrome://tracing
+    // and Perfetto. Every thread appends to its own ring of the most recent
+    // events without taking a lock, so markers are cheap enough to leave on.
+    // Names must be string literals, since only the pointer is stored. A ring
+    // goes back to a free list when its thread exits and is reused by the
+    // next new thread, so memory is bounded by the peak thread count.
+    //
+    // dumpTrace() may run while other threads are recording; events that are
+    // overwritten while it reads them are left out.
+    uint64_t traceNow();
+    void traceEvent(const char *name, uint64_t start, uint64_t end);
+    void traceThreadName(const char *name);
+    bool dumpTrace(const std::string &path, std::string &error);
+
+    class TraceScope
+    {
+    public:
+        TraceScope(const char *name);
+        ~TraceScope();
+
+    private:
+        const char *name;
+        uint64_t start;
+    };
+}
+
+#endif
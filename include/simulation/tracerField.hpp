@@ -0,0 +1,39 @@
+#ifndef TRACERFIELD_HPP
+#define TRACERFIELD_HPP
+
+#include "simulation/body.hpp"
+#include "simulation/threadPool.hpp"
+#include <vector>
+#include <cmath>
+#include <random>
+
+namespace sim
+{
+    // Massless 2D test particles moved by a handful of massive source bodies.
+    // Tracers are stored as separate coordinate arrays and never act as
+    // sources, so a step costs O(tracers * sources). The tracer loop is the
+    // innermost one so the compiler can vectorise it, and blocks of tracers
+    // are spread over the thread pool.
+    class TracerField
+    {
+    public:
+        TracerField(ThreadPool &pool);
+
+        void seedDisk(const std::vector<Body> &sources, int count, float innerRadius, float outerRadius, float G, unsigned int seed);
+        void step(const std::vector<Body> &sources, float G, float alpha, float deltaTime);
+        void writePositions(float *out, float scale) const;
+        void clear();
+        int size() const;
+
+    private:
+        void stepBlock(int begin, int end, float alphaSqr, float deltaTime);
+
+        static const int blockSize = 1024;
+
+        ThreadPool &pool;
+        std::vector<float> x, y, vx, vy;
+        std::vector<float> sourceX, sourceY, sourceGM;
+    };
+}
+
+#endif
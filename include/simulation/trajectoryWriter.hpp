@@ -0,0 +1,73 @@
+#ifndef TRAJECTORYWRITER_HPP
+#define TRAJECTORYWRITER_HPP
+
+#include "simulation/body.hpp"
+#include "simulation/threadPool.hpp"
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdio>
+
+namespace sim
+{
+    // Streams recorded frames to chunked binary files on a background thread.
+    // Frames are copied into a fixed ring of staging buffers that is allocated
+    // once in start(); when every buffer is still waiting for the disk, record()
+    // either drops the frame or waits, depending on the policy. A failed write
+    // stops the recording; hasFailed() and getError() report why.
+    class TrajectoryWriter
+    {
+    public:
+        enum class Policy
+        {
+            Drop,
+            Block
+        };
+
+        TrajectoryWriter(ThreadPool &pool);
+        ~TrajectoryWriter();
+
+        bool start(const std::string &prefix, int dimension, int numOfBodies, int numBuffers, int framesPerChunk, Policy policy);
+        bool record(const std::vector<Body> &bodies, unsigned long long step);
+        void stop();
+        bool isRecording() const;
+        bool hasFailed() const;
+        std::string getError();
+
+        unsigned long long getFramesWritten() const;
+        unsigned long long getFramesDropped() const;
+        unsigned long long getBytesWritten() const;
+
+    private:
+        struct Frame
+        {
+            unsigned long long step;
+            int count;
+            std::vector<float> data;
+        };
+
+        void writer();
+        bool openChunk();
+        void fail(const std::string &message);
+
+        ThreadPool &pool;
+        std::vector<Frame> ring;
+        std::vector<bool> full;
+        int head, tail;
+        std::mutex mutex;
+        std::condition_variable filled, freed;
+        std::thread thread;
+        std::atomic<bool> running, failed;
+        std::string error;
+        Policy policy;
+        std::string prefix;
+        int dimension, framesPerChunk, chunkFrames, chunkIndex;
+        FILE *file;
+        std::atomic<unsigned long long> framesWritten, framesDropped, bytesWritten;
+    };
+}
+
+#endif
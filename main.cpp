@@ -7,6 +7,13 @@
 #include <math.h>
 #include <algorithm>
 #include <random>
+#include <numeric>
+#include <future>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cfloat>
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
@@ -19,9 +26,28 @@
 #include "simulation/quadTree.hpp"
 #include "simulation/body.hpp"
 #include "simulation/simulation.hpp"
+#include "simulation/regularization.hpp"
+#include "simulation/collisionSolver.hpp"
+#include "simulation/threadPool.hpp"
+#include "simulation/tracerField.hpp"
+#include "simulation/ensemble.hpp"
+#include "simulation/stabilityMap.hpp"
+#include "simulation/snapshot.hpp"
+#include "simulation/trajectoryWriter.hpp"
+#include "simulation/replayBuffer.hpp"
+#include "simulation/particleLoader.hpp"
+#include "simulation/generator.hpp"
+#include "simulation/octree.hpp"
+#include "simulation/diagnostics.hpp"
+#include "simulation/profiler.hpp"
+#include "simulation/hardwareCounters.hpp"
+#include "simulation/trace.hpp"
 #include "gui/shader.hpp"
 #include "gui/camera.hpp"
+#include "gui/densityRenderer.hpp"
+#include "gui/frameRecorder.hpp"
 
+bool parseArguments(int argc, char **argv);
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
@@ -38,15 +64,43 @@ void drawInitThreeBody3D(GLFWwindow *window);
 void drawInitTwoFixedBody();
 void drawInitNBodySmall();
 void drawInitNBodyBig();
+void drawInitTracers();
+void drawInitNBodyBig3D(GLFWwindow *window);
 void drawSim(GLFWwindow *window);
+void finishStep();
 void drawSimThreeBody2D(GLFWwindow *window);
 void drawSimThreeBody3D(GLFWwindow *window);
 void drawSimTwoFixedBody(GLFWwindow *window);
 void drawSimNBodySmall(GLFWwindow *window);
 void drawSimNBodyBig(GLFWwindow *window);
+void stepNBodyBig(double dt);
+void savePreviousPositions();
+void drawSimTracers(GLFWwindow *window);
+void drawSimNBodyBig3D(GLFWwindow *window);
+void extractFrustum(const glm::mat4 &clip, float planes[6][4]);
+void mergeBodies();
+void pushTrail(int count);
+void initGpuTrail();
+void uploadPositions();
+size_t positionBytes(int count);
+uint16_t quantizePosition(float x);
+void setPositionUniforms(gui::Shader &shader);
+void uploadMasses();
+void drawEnsembleControls();
+std::string runEnsemble(std::vector<sim::EnsembleRun> initial, int dimension, double duration);
+void drawStabilityMapControls(int movable, double softening);
+std::string runStabilityMap(std::vector<sim::Body> initial, int movable, double softening, int size, float range, double duration);
+void saveSnapshot();
+void saveTrace();
+bool loadSnapshot();
+bool canReplay();
+void drawReplay();
+void drawProfiler();
+void drawDiagnostics();
+void drawDiagnosticsControls();
+void startDiagnostics();
 
 float vectorMagnitude(std::vector<float> &coords);
-float dotProduct(int dimension, std::vector<float> &coords1, std::vector<float> &coords2);
 
 struct trailStruct
 {
@@ -60,6 +114,7 @@ const unsigned int SCR_HEIGHT = 1000;
 sim::States state = sim::States::MENU;
 sim::Option option = sim::Option::MENU;
 std::vector<sim::Body> bodies;
+std::vector<int> bodyIds;
 int dimension = 0;
 std::vector<float> vertices;
 const std::vector<float> lineVertices({-100000.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f,
@@ -69,31 +124,139 @@ const std::vector<float> lineVertices({-100000.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
                                        0.0f, 0.0f, -100000.0f, 3.0f, 0.0f, 0.0f, 0.0f, 3.0f,
                                        0.0f, 0.0f, 0.0f, 3.0f, 0.0f, 0.0f, 100000.0f, 3.0f});
 std::vector<trailStruct> trailVertices;
-gui::Shader shaderProgram, shaderProgramTrail, shaderProgramLine;
-unsigned int VBO = 0, VAO = 0, trailVBO = 0, trailVAO = 0, lineVBO = 0, lineVAO = 0;
+gui::Shader shaderProgram, shaderProgramTrail, shaderProgramLine, shaderProgramTracer;
+unsigned int VBO = 0, VAO = 0, trailVBO = 0, trailVAO = 0, lineVBO = 0, lineVAO = 0, tracerVBO = 0, tracerVAO = 0;
 double currentTime, deltaTime;
 float radius;
+const float worldScale = 1.0f / 1000.0f;
+const float viewBounds = 1.1f / worldScale;
+bool compactPositions = false;
+gui::DensityRenderer densityRenderer;
+bool densityView = false;
+float densityExposure = 40.0f;
+unsigned int massVBO = 0;
+unsigned int prevVBO = 0;
+int physicsRate = 0;
+double physicsAccumulator = 0.0;
+float renderLag = 0.0f;
+const int maxStepsPerFrame = 8;
 const double G = 6674;
 const double alpha = 5.0;
+sim::Regularization regularization(G, 20.0 * alpha, 16);
+sim::ThreadPool threadPool;
+sim::CollisionSolver collisionSolver(threadPool);
+sim::TracerField tracerField(threadPool);
+sim::TrajectoryWriter trajectoryWriter(threadPool);
+sim::ParticleLoader particleLoader(threadPool);
+sim::Generator generator(threadPool);
 bool trail = false;
 bool walls = false;
 bool collisions = false;
+bool merging = false;
 bool infos = false;
 float restitutionCoeff = 0.0f;
 const unsigned int trailLength = 500;
+unsigned int trailHead = 0;
+unsigned int gpuTrailLength = 0, trailTexture = 0;
 int numOfBodies = 0;
 const float theta = 2.0f;
+bool fixedMasses = true;
+int numOfTracers = 100000;
+float tracerInnerRadius = 200.0f;
+float tracerOuterRadius = 1000.0f;
+const float tracerRadius = 2.0f;
+int ensembleRuns = 1000;
+float ensembleSpread = 10.0f;
+float ensembleDuration = 100.0f;
+const double ensembleStep = 0.001;
+const double escapeDistance = 3000.0;
+std::future<std::string> ensembleJob;
+std::string ensembleSummary;
+int mapSize = 64;
+float mapRange = 1000.0f;
+float mapDuration = 10.0f;
+const double mapStep = 0.001;
+std::future<std::string> mapJob;
+std::string mapSummary;
+std::atomic<bool> cancelJobs(false);
+std::string snapshotPath = "snapshot.nbs";
+std::string snapshotStatus;
+bool recording = false;
+bool dropFrames = true;
+int recordInterval = 10;
+unsigned long long simStep = 0;
+sim::ReplayBuffer replayBuffer(256u << 20, 30);
+std::vector<float> replayVertices;
+bool paused = false;
+int replayFrame = -1;
+char importPath[256] = "bodies.csv";
+std::string importStatus;
+int distribution = (int)sim::Distribution::Uniform;
+int generatorCount = 10000;
+int generatorSeed = 1;
+float generatorScale = 1000.0f;
+sim::Octree octree(threadPool);
+std::vector<float> visiblePoints, accelerations, potentials;
+sim::Diagnostics diagnostics(threadPool);
+int diagnosticsInterval = 0;
+float lodPixels = 2.0f;
+const float openingAngle = 0.7f;
+bool headless = false;
+int headlessFrames = 0;
+std::string framePrefix = "frame";
+gui::FrameRecorder frameRecorder;
+sim::Profiler profiler(240);
+bool profilerVisible = false;
+std::string tracePath = "trace.json";
+bool traceOnExit = false;
+sim::HardwareCounters hardwareCounters;
+bool useCounters = false;
 int selectedBody;
 glm::mat4 view;
 glm::mat4 projection;
 gui::Camera camera(SCR_WIDTH, SCR_HEIGHT);
 
-int main()
+int main(int argc, char **argv)
 {
+    if (!parseArguments(argc, argv))
+    {
+        return 1;
+    }
+    sim::traceThreadName("Render");
+    if (useCounters)
+    {
+        std::string error;
+        if (hardwareCounters.open(error))
+        {
+            profiler.setCounters(&hardwareCounters);
+        }
+        else
+        {
+            std::cerr << "Hardware counters unavailable: " << error << std::endl;
+        }
+    }
+#ifdef GLFW_PLATFORM_NULL
+    // Without a display, GLFW's null platform still creates an OSMesa context.
+    bool noDisplay = getenv("DISPLAY") == NULL && getenv("WAYLAND_DISPLAY") == NULL;
+    if (headless && noDisplay)
+    {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
+#endif
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (headless)
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef GLFW_PLATFORM_NULL
+        if (noDisplay)
+        {
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        }
+#endif
+    }
 
     GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "N Body Simulation", NULL, NULL);
     if (window == NULL)
@@ -117,6 +280,7 @@ int main()
         return 1;
     }
     glEnable(GL_PROGRAM_POINT_SIZE);
+    gui::Shader::enableBinaryCache("shader_cache", (GLADloadproc)glfwGetProcAddress);
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -127,6 +291,24 @@ int main()
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 330 core");
 
+    if (headless)
+    {
+        // The snapshot opens in its mode's Init screen, whose Start button is
+        // pressed on the first frame.
+        if (!loadSnapshot())
+        {
+            glfwTerminate();
+            return 1;
+        }
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        if (!frameRecorder.create(width, height, framePrefix, 8))
+        {
+            glfwTerminate();
+            return 1;
+        }
+    }
+
     currentTime = glfwGetTime();
 
     while (!glfwWindowShouldClose(window))
@@ -135,21 +317,60 @@ int main()
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
+        if (headless)
+        {
+            frameRecorder.bind();
+        }
         glClearColor(0.45f, 0.55f, 0.60f, 1.00f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         double newTime = glfwGetTime();
-        deltaTime = newTime - currentTime;
+        deltaTime = headless ? 1.0 / 60.0 : newTime - currentTime;
         currentTime = newTime;
 
+        bool simFrame = state == sim::States::Sim;
         draw(window);
 
+        profiler.begin(sim::Phase::Gui);
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        profiler.end(sim::Phase::Gui);
+        if (headless && simFrame)
+        {
+            frameRecorder.capture();
+            if (frameRecorder.getFramesCaptured() >= headlessFrames)
+            {
+                glfwSetWindowShouldClose(window, true);
+            }
+        }
+        profiler.begin(sim::Phase::Swap);
         glfwSwapBuffers(window);
+        profiler.end(sim::Phase::Swap);
+        profiler.endFrame();
         glfwPollEvents();
     }
 
+    if (headless)
+    {
+        frameRecorder.destroy();
+        std::cout << "Wrote " << frameRecorder.getFramesWritten() << " frames to " << framePrefix
+                  << "_*.ppm" << std::endl;
+        if (frameRecorder.getFramesDropped() > 0)
+        {
+            std::cerr << frameRecorder.getFramesDropped() << " frames could not be read back" << std::endl;
+        }
+    }
+    trajectoryWriter.stop();
+    cancelJobs = true;
+    if (ensembleJob.valid())
+    {
+        ensembleJob.wait();
+    }
+    if (mapJob.valid())
+    {
+        mapJob.wait();
+    }
+
     glDeleteVertexArrays(1, &VAO);
     stbi_image_free(icon.pixels);
     glDeleteBuffers(1, &VBO);
@@ -157,9 +378,21 @@ int main()
     glDeleteBuffers(1, &lineVBO);
     glDeleteVertexArrays(1, &trailVAO);
     glDeleteBuffers(1, &trailVBO);
+    glDeleteTextures(1, &trailTexture);
+    glDeleteBuffers(1, &massVBO);
+    glDeleteBuffers(1, &prevVBO);
+    densityRenderer.destroy();
+    glDeleteVertexArrays(1, &tracerVAO);
+    glDeleteBuffers(1, &tracerVBO);
     shaderProgram.destroy();
     shaderProgramTrail.destroy();
     shaderProgramLine.destroy();
+    shaderProgramTracer.destroy();
+    gui::Shader::clearCache();
+    if (traceOnExit)
+    {
+        saveTrace();
+    }
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -168,6 +401,43 @@ int main()
     return 0;
 }
 
+bool parseArguments(int argc, char **argv)
+{
+    // [--headless FRAMES [--snapshot PATH] [--out PREFIX]] [--trace PATH] [--counters]
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--headless" && i + 1 < argc)
+        {
+            headless = true;
+            headlessFrames = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--snapshot" && i + 1 < argc)
+        {
+            snapshotPath = argv[++i];
+        }
+        else if (arg == "--out" && i + 1 < argc)
+        {
+            framePrefix = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+            traceOnExit = true;
+        }
+        else if (arg == "--counters")
+        {
+            useCounters = true;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--headless FRAMES [--snapshot PATH] [--out PREFIX]] [--trace PATH] [--counters]" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 void processInput(GLFWwindow *window)
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -201,11 +471,17 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     {
         if (state == sim::States::Sim)
         {
-            if (option == sim::Option::ThreeBody3D)
+            if (option == sim::Option::ThreeBody3D || option == sim::Option::NBodyBig3D)
             {
                 glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
             }
             state = sim::States::Init;
+            trajectoryWriter.stop();
+            diagnostics.stop();
+            regularization.reset();
+            replayBuffer.clear();
+            paused = false;
+            replayFrame = -1;
             glBindVertexArray(0);
             glDeleteVertexArrays(1, &VAO);
             glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -218,6 +494,17 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
             glDeleteVertexArrays(1, &trailVAO);
             glBindBuffer(GL_ARRAY_BUFFER, 0);
             glDeleteBuffers(1, &trailVBO);
+            glDeleteTextures(1, &trailTexture);
+            trailTexture = 0;
+            glDeleteBuffers(1, &massVBO);
+            massVBO = 0;
+            glDeleteBuffers(1, &prevVBO);
+            prevVBO = 0;
+            densityRenderer.destroy();
+            glBindVertexArray(0);
+            glDeleteVertexArrays(1, &tracerVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glDeleteBuffers(1, &tracerVBO);
         }
         else if (state == sim::States::Init)
         {
@@ -225,11 +512,17 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
             vertices.clear();
             trailVertices.clear();
             bodies.clear();
+            bodyIds.clear();
+            tracerField.clear();
             dimension = 0;
             trail = false;
             walls = false;
             infos = false;
             collisions = false;
+            merging = false;
+            recording = false;
+            compactPositions = false;
+            densityView = false;
             radius = 0.0f;
             numOfBodies = 0;
         }
@@ -238,6 +531,26 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     {
         infos = !infos;
     }
+    if (state == sim::States::Sim && canReplay() && key == GLFW_KEY_SPACE && action == GLFW_PRESS && replayBuffer.size() > 0)
+    {
+        paused = !paused;
+        if (paused && replayFrame < 0)
+        {
+            replayFrame = replayBuffer.size() - 1;
+        }
+    }
+    if (state == sim::States::Sim && key == GLFW_KEY_F5 && action == GLFW_PRESS)
+    {
+        saveSnapshot();
+    }
+    if (state == sim::States::Sim && key == GLFW_KEY_F3 && action == GLFW_PRESS)
+    {
+        profilerVisible = !profilerVisible;
+    }
+    if (key == GLFW_KEY_F6 && action == GLFW_PRESS)
+    {
+        saveTrace();
+    }
 }
 void mouse_callback(GLFWwindow *window, double xposIn, double yposIn)
 {
@@ -253,6 +566,7 @@ void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
 
 void draw(GLFWwindow *window)
 {
+    sim::TraceScope trace("draw");
     if (state == sim::States::MENU)
     {
         drawMenu();
@@ -264,6 +578,14 @@ void draw(GLFWwindow *window)
     else if (state == sim::States::Sim)
     {
         drawSim(window);
+        if (diagnostics.isRunning() && diagnostics.hasSample() && replayFrame < 0)
+        {
+            drawDiagnostics();
+        }
+        if (profilerVisible)
+        {
+            drawProfiler();
+        }
     }
 }
 
@@ -290,10 +612,10 @@ void drawMenu()
                      ImGuiWindowFlags_NoSavedSettings |
                      ImGuiWindowFlags_AlwaysAutoResize |
                      ImGuiWindowFlags_NoBackground);
-    std::vector<const char *> buttonNames({"Three bodies", "Fixed 2 bodies", "Small n bodies", "Big n bodies", "Three bodies 3D"});
-    std::vector<sim::Option> buttonOption({sim::Option::ThreeBody2D, sim::Option::TwoFixedBody, sim::Option::NBodySmall, sim::Option::NBodyBig, sim::Option::ThreeBody3D});
-    ImVec2 button_size = ImVec2(window_size.x, window_size.y / 6.0f);
-    ImVec2 dummy_size = ImVec2(window_size.x, window_size.y / 6.0f / 12.0f);
+    std::vector<const char *> buttonNames({"Three bodies", "Fixed 2 bodies", "Small n bodies", "Big n bodies", "Three bodies 3D", "Tracers", "Big n bodies 3D"});
+    std::vector<sim::Option> buttonOption({sim::Option::ThreeBody2D, sim::Option::TwoFixedBody, sim::Option::NBodySmall, sim::Option::NBodyBig, sim::Option::ThreeBody3D, sim::Option::Tracers, sim::Option::NBodyBig3D});
+    ImVec2 button_size = ImVec2(window_size.x, window_size.y / 9.0f);
+    ImVec2 dummy_size = ImVec2(window_size.x, window_size.y / 9.0f / 12.0f);
     ImGui::BeginGroup();
     for (int i = 0; i < buttonNames.size(); i++)
     {
@@ -321,7 +643,7 @@ void drawMenu()
                 break;
             case sim::Option::NBodyBig:
                 radius = 3.0f;
-                numOfBodies = 10000;
+                numOfBodies = generatorCount;
                 dimension = 2;
                 break;
             case sim::Option::ThreeBody3D:
@@ -329,6 +651,16 @@ void drawMenu()
                 numOfBodies = 3;
                 dimension = 3;
                 break;
+            case sim::Option::Tracers:
+                radius = 10.0f;
+                numOfBodies = 1;
+                dimension = 2;
+                break;
+            case sim::Option::NBodyBig3D:
+                radius = 3.0f;
+                numOfBodies = generatorCount;
+                dimension = 3;
+                break;
             }
             bodies = std::vector<sim::Body>(numOfBodies, sim::Body(dimension));
             switch (option)
@@ -371,16 +703,8 @@ void drawMenu()
                 bodies[0].mass = 1.0f;
                 break;
             case sim::Option::NBodyBig:
-                srand(time(NULL));
-                for (int i = 0; i < numOfBodies; i++)
-                {
-                    bodies[i].mass = std::max((float)rand() / RAND_MAX, 0.1f) * 0.1f;
-                    for (int j = 0; j < dimension; j++)
-                    {
-                        bodies[i].coord[j] = ((float)rand() / RAND_MAX - 0.5f) * 2000.0f;
-                        bodies[i].veloc[j] = ((float)rand() / RAND_MAX - 0.5f) * 50.0f;
-                    }
-                }
+                generator.generate((sim::Distribution)distribution, numOfBodies, dimension, generatorScale,
+                                   G, alpha, generatorSeed, bodies);
                 break;
             case sim::Option::ThreeBody3D:
                 bodies[0].coord[0] = -200.0f;
@@ -405,9 +729,25 @@ void drawMenu()
                 bodies[2].veloc[2] = 0.0f;
                 bodies[2].mass = 200.0f;
                 break;
+            case sim::Option::Tracers:
+                bodies[0].coord[0] = 0.0f;
+                bodies[0].coord[1] = 0.0f;
+                bodies[0].veloc[0] = 0.0f;
+                bodies[0].veloc[1] = 0.0f;
+                bodies[0].mass = 100.0f;
+                break;
+            case sim::Option::NBodyBig3D:
+                generator.generate((sim::Distribution)distribution, numOfBodies, dimension, generatorScale,
+                                   G, alpha, generatorSeed, bodies);
+                break;
             }
         }
     }
+    ImGui::Dummy(dummy_size);
+    if (ImGui::Button("Load snapshot", button_size))
+    {
+        loadSnapshot();
+    }
     ImGui::EndGroup();
     ImGui::SameLine();
     ImGui::PushFont(smallFont);
@@ -416,7 +756,11 @@ void drawMenu()
     ImGui::Dummy(ImVec2(30.0f, 0));
     ImGui::SameLine();
     ImGui::BeginGroup();
-    ImGui::Text("Keybinds: \nPrevious screen: CTRL\nExit: ESC\nInfos: T\nMovement(3D only): WASD\nLock cam(3D only): R.CLICK");
+    ImGui::Text("Keybinds: \nPrevious screen: CTRL\nExit: ESC\nInfos: T\nSave snapshot: F5\nProfiler: F3\nDump trace: F6\nPause/replay(2D only): SPACE\nMovement(3D only): WASD\nLock cam(3D only): R.CLICK");
+    if (!snapshotStatus.empty())
+    {
+        ImGui::Text("%s", snapshotStatus.c_str());
+    }
     ImGui::Text("Units:\nLength: 10^11m\nMass: 10^4kg\nTime: 1s sim = 1mo IRL");
     ImGui::EndGroup();
     ImGui::EndGroup();
@@ -443,11 +787,22 @@ void drawInit(GLFWwindow *window)
     case sim::Option::ThreeBody3D:
         drawInitThreeBody3D(window);
         break;
+    case sim::Option::Tracers:
+        drawInitTracers();
+        break;
+    case sim::Option::NBodyBig3D:
+        drawInitNBodyBig3D(window);
+        break;
     }
 }
 
 void drawSim(GLFWwindow *window)
 {
+    if (replayFrame >= 0)
+    {
+        drawReplay();
+        return;
+    }
     switch (option)
     {
     case sim::Option::NBodyBig:
@@ -465,6 +820,51 @@ void drawSim(GLFWwindow *window)
     case sim::Option::TwoFixedBody:
         drawSimTwoFixedBody(window);
         break;
+    case sim::Option::Tracers:
+        drawSimTracers(window);
+        break;
+    case sim::Option::NBodyBig3D:
+        drawSimNBodyBig3D(window);
+        break;
+    }
+    // Large n Bodies steps on its own clock and finishes its steps itself;
+    // every other mode takes one step per frame.
+    if (option != sim::Option::NBodyBig)
+    {
+        finishStep();
+    }
+    if (trajectoryWriter.isRecording() || trajectoryWriter.hasFailed())
+    {
+        ImGuiIO &io = ImGui::GetIO();
+        ImGui::SetNextWindowPos(ImVec2(0.0f, io.DisplaySize.y), ImGuiCond_Always, ImVec2(0.0f, 1.0f));
+        ImGui::SetNextWindowBgAlpha(0.0f);
+        ImGui::Begin("Recording", nullptr,
+                     ImGuiWindowFlags_NoDecoration |
+                         ImGuiWindowFlags_NoMove |
+                         ImGuiWindowFlags_NoSavedSettings |
+                         ImGuiWindowFlags_AlwaysAutoResize |
+                         ImGuiWindowFlags_NoBackground);
+        ImGui::Text("%s: %llu frames, %llu dropped, %.1f MB",
+                    trajectoryWriter.hasFailed() ? trajectoryWriter.getError().c_str() : "Recording",
+                    trajectoryWriter.getFramesWritten(), trajectoryWriter.getFramesDropped(),
+                    trajectoryWriter.getBytesWritten() / 1048576.0);
+        ImGui::End();
+    }
+}
+
+void finishStep()
+{
+    simStep++;
+    profiler.addSteps(1);
+    // Frames where the physics clock did not advance would only repeat the
+    // previous state in the replay.
+    if (canReplay())
+    {
+        replayBuffer.push(bodies, dimension);
+    }
+    if (trajectoryWriter.isRecording() && simStep % recordInterval == 0)
+    {
+        trajectoryWriter.record(bodies, simStep);
     }
 }
 
@@ -484,13 +884,18 @@ void drawInitThreeBody2D()
     ImGui::BeginGroup();
     ImVec2 button_size = ImVec2(window_size.x / 4.0f, window_size.y / 16.0f);
     ImGui::SetCursorPos(ImVec2((window_size.x - button_size.x) / 2.0f, 20));
-    if (ImGui::Button("Start", button_size))
+    if (ImGui::Button("Start", button_size) || headless)
     {
+        if (bodyIds.size() != numOfBodies)
+        {
+            bodyIds = std::vector<int>(numOfBodies);
+            std::iota(bodyIds.begin(), bodyIds.end(), 0);
+        }
         vertices = std::vector<float>(numOfBodies * dimension);
         for (int i = 0; i < numOfBodies; i++)
         {
-            vertices[i * dimension] = bodies[i].coord[0] / 1000.0f;
-            vertices[i * dimension + 1] = bodies[i].coord[1] / 1000.0f;
+            vertices[i * dimension] = bodies[i].coord[0];
+            vertices[i * dimension + 1] = bodies[i].coord[1];
         }
         shaderProgram = gui::Shader("resources/shaders/vertexShaders/threeBodies2d.ver",
                                     "resources/shaders/fragmentShaders/threeBodies2d.frag");
@@ -498,7 +903,7 @@ void drawInitThreeBody2D()
         glGenBuffers(1, &VBO);
         glBindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STREAM_DRAW);
         glVertexAttribPointer(0, dimension, GL_FLOAT, GL_FALSE, dimension * sizeof(float), (void *)0);
 
         glEnableVertexAttribArray(0);
@@ -508,13 +913,14 @@ void drawInitThreeBody2D()
         if (trail)
         {
             trailVertices = std::vector<trailStruct>(trailLength * numOfBodies);
-            for (int i = 0; i < numOfBodies; i++)
+            trailHead = 0;
+            for (int j = 0; j < trailLength; j++)
             {
-                for (int j = 0; j < trailLength; j++)
+                for (int i = 0; i < numOfBodies; i++)
                 {
-                    trailVertices[i * trailLength + j].x = vertices[i * 2];
-                    trailVertices[i * trailLength + j].y = vertices[i * 2 + 1];
-                    trailVertices[i * trailLength + j].index = j;
+                    trailVertices[j * numOfBodies + i].x = vertices[i * 2];
+                    trailVertices[j * numOfBodies + i].y = vertices[i * 2 + 1];
+                    trailVertices[j * numOfBodies + i].index = j;
                 }
             }
             shaderProgramTrail = gui::Shader("resources/shaders/vertexShaders/threeBodies2dTrail.ver", "resources/shaders/fragmentShaders/threeBodies2dTrail.frag");
@@ -592,11 +998,14 @@ void drawInitThreeBody2D()
     if (collisions)
     {
         ImGui::Text("Other:");
+        ImGui::Checkbox("Merging", &merging);
         if (ImGui::InputFloat("COR", &restitutionCoeff, 0.1f, 1.0f, "%.2f"))
         {
             restitutionCoeff = std::max(0.0f, std::min(restitutionCoeff, 1.0f));
         }
     }
+    drawEnsembleControls();
+    drawStabilityMapControls(numOfBodies, alpha);
     ImGui::EndGroup();
     ImGui::EndGroup();
     ImGui::End();
@@ -617,14 +1026,14 @@ void drawInitTwoFixedBody()
     ImGui::BeginGroup();
     ImVec2 button_size = ImVec2(window_size.x / 4.0f, window_size.y / 16.0f);
     ImGui::SetCursorPos(ImVec2((window_size.x - button_size.x) / 2.0f, 20));
-    if (ImGui::Button("Start", button_size))
+    if (ImGui::Button("Start", button_size) || headless)
     {
         vertices = std::vector<float>(numOfBodies * dimension);
         for (int i = 0; i < numOfBodies; i++)
         {
             for (int j = 0; j < dimension; j++)
             {
-                vertices[i * dimension + j] = bodies[i].coord[j] / 1000.0f;
+                vertices[i * dimension + j] = bodies[i].coord[j];
             }
         }
         shaderProgram = gui::Shader("resources/shaders/vertexShaders/threeBodies2d.ver",
@@ -633,7 +1042,7 @@ void drawInitTwoFixedBody()
         glGenBuffers(1, &VBO);
         glBindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STREAM_DRAW);
         glVertexAttribPointer(0, dimension, GL_FLOAT, GL_FALSE, dimension * sizeof(float), (void *)0);
         glEnableVertexAttribArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -641,6 +1050,7 @@ void drawInitTwoFixedBody()
         if (trail)
         {
             trailVertices = std::vector<trailStruct>(trailLength);
+            trailHead = 0;
             for (int j = 0; j < trailLength; j++)
             {
                 trailVertices[j].x = vertices[0];
@@ -737,6 +1147,7 @@ void drawInitTwoFixedBody()
             restitutionCoeff = std::max(0.0f, std::min(restitutionCoeff, 1.0f));
         }
     }
+    drawStabilityMapControls(1, 0.0);
     ImGui::EndGroup();
     ImGui::EndGroup();
 
@@ -759,14 +1170,19 @@ void drawInitNBodySmall()
     ImGui::BeginGroup();
     ImVec2 button_size = ImVec2(window_size.x / 4.0f, window_size.y / 16.0f);
     ImGui::SetCursorPos(ImVec2((window_size.x - button_size.x) / 2.0f, 20));
-    if (ImGui::Button("Start", button_size))
+    if (ImGui::Button("Start", button_size) || headless)
     {
+        if (bodyIds.size() != numOfBodies)
+        {
+            bodyIds = std::vector<int>(numOfBodies);
+            std::iota(bodyIds.begin(), bodyIds.end(), 0);
+        }
         vertices = std::vector<float>(numOfBodies * dimension);
         for (int i = 0; i < numOfBodies; i++)
         {
             for (int j = 0; j < dimension; j++)
             {
-                vertices[i * dimension + j] = bodies[i].coord[j] / 1000.0f;
+                vertices[i * dimension + j] = bodies[i].coord[j];
             }
         }
         shaderProgram = gui::Shader("resources/shaders/vertexShaders/threeBodies2d.ver",
@@ -775,7 +1191,7 @@ void drawInitNBodySmall()
         glGenBuffers(1, &VBO);
         glBindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STREAM_DRAW);
         glVertexAttribPointer(0, dimension, GL_FLOAT, GL_FALSE, dimension * sizeof(float), (void *)0);
 
         glEnableVertexAttribArray(0);
@@ -786,13 +1202,14 @@ void drawInitNBodySmall()
         {
 
             trailVertices = std::vector<trailStruct>(trailLength * numOfBodies);
-            for (int i = 0; i < numOfBodies; i++)
+            trailHead = 0;
+            for (int j = 0; j < trailLength; j++)
             {
-                for (int j = 0; j < trailLength; j++)
+                for (int i = 0; i < numOfBodies; i++)
                 {
-                    trailVertices[i * trailLength + j].x = vertices[i * 2];
-                    trailVertices[i * trailLength + j].y = vertices[i * 2 + 1];
-                    trailVertices[i * trailLength + j].index = j;
+                    trailVertices[j * numOfBodies + i].x = vertices[i * 2];
+                    trailVertices[j * numOfBodies + i].y = vertices[i * 2 + 1];
+                    trailVertices[j * numOfBodies + i].index = j;
                 }
             }
             shaderProgramTrail = gui::Shader("resources/shaders/vertexShaders/threeBodies2dTrail.ver", "resources/shaders/fragmentShaders/threeBodies2dTrail.frag");
@@ -871,6 +1288,7 @@ void drawInitNBodySmall()
     if (collisions)
     {
         ImGui::Text("Other:");
+        ImGui::Checkbox("Merging", &merging);
         if (ImGui::InputFloat("COR", &restitutionCoeff, 0.1f, 1.0f, "%.2f"))
         {
             restitutionCoeff = std::max(0.0f, std::min(restitutionCoeff, 1.0f));
@@ -897,14 +1315,19 @@ void drawInitNBodyBig()
     ImGui::BeginGroup();
     ImVec2 button_size = ImVec2(window_size.x / 3.0f, window_size.y / 12.0f);
     ImGui::SetCursorPos(ImVec2((window_size.x - button_size.x) / 2.0f, window_size.y / 2.0f - button_size.y));
-    if (ImGui::Button("Start", button_size))
+    if (ImGui::Button("Start", button_size) || headless)
     {
+        if (bodyIds.size() != numOfBodies)
+        {
+            bodyIds = std::vector<int>(numOfBodies);
+            std::iota(bodyIds.begin(), bodyIds.end(), 0);
+        }
         vertices = std::vector<float>(numOfBodies * dimension);
         for (int i = 0; i < numOfBodies; i++)
         {
             for (int j = 0; j < dimension; j++)
             {
-                vertices[i * dimension + j] = bodies[i].coord[j] / 1000.0f;
+                vertices[i * dimension + j] = bodies[i].coord[j];
             }
         }
         shaderProgram = gui::Shader("resources/shaders/vertexShaders/bigNBodies.ver",
@@ -914,23 +1337,171 @@ void drawInitNBodyBig()
         glGenBuffers(1, &VBO);
         glBindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
-        glVertexAttribPointer(0, dimension, GL_FLOAT, GL_FALSE, dimension * sizeof(float), (void *)0);
+        if (compactPositions)
+        {
+            glBufferData(GL_ARRAY_BUFFER, positionBytes(numOfBodies), NULL, GL_STREAM_DRAW);
+            glVertexAttribPointer(0, dimension, GL_UNSIGNED_SHORT, GL_TRUE, dimension * sizeof(uint16_t), (void *)0);
+            uploadPositions();
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STREAM_DRAW);
+            glVertexAttribPointer(0, dimension, GL_FLOAT, GL_FALSE, dimension * sizeof(float), (void *)0);
+        }
 
         glEnableVertexAttribArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindVertexArray(0);
 
+        if (densityView)
+        {
+            densityRenderer.create(2);
+            glGenBuffers(1, &massVBO);
+            uploadMasses();
+        }
+
+        if (physicsRate > 0)
+        {
+            glGenBuffers(1, &prevVBO);
+            savePreviousPositions();
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, prevVBO);
+            if (compactPositions)
+            {
+                glVertexAttribPointer(2, dimension, GL_UNSIGNED_SHORT, GL_TRUE, dimension * sizeof(uint16_t), (void *)0);
+            }
+            else
+            {
+                glVertexAttribPointer(2, dimension, GL_FLOAT, GL_FALSE, dimension * sizeof(float), (void *)0);
+            }
+            glEnableVertexAttribArray(2);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindVertexArray(0);
+        }
+        physicsAccumulator = 0.0;
+        renderLag = 0.0f;
+
+        if (trail)
+        {
+            shaderProgramTrail = gui::Shader("resources/shaders/vertexShaders/bigNBodiesTrail.ver", "resources/shaders/fragmentShaders/threeBodies2dTrail.frag");
+            if (trailVAO != 0)
+            {
+                glBindVertexArray(0);
+                glDeleteVertexArrays(1, &trailVAO);
+            }
+            if (trailVBO != 0)
+            {
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                glDeleteBuffers(1, &trailVBO);
+            }
+            glGenVertexArrays(1, &trailVAO);
+            glGenBuffers(1, &trailVBO);
+            glGenTextures(1, &trailTexture);
+            initGpuTrail();
+        }
+        simStep = 0;
+        startDiagnostics();
+        if (recording)
+        {
+            trajectoryWriter.start("trajectory", dimension, numOfBodies, 8, 100,
+                                   dropFrames ? sim::TrajectoryWriter::Policy::Drop : sim::TrajectoryWriter::Policy::Block);
+        }
         state = sim::States::Sim;
     }
     ImGui::SameLine();
     ImGui::SetCursorPos(ImVec2((window_size.x + button_size.x) / 2.75f, window_size.y / 2.0f - button_size.y + 100));
+    ImGui::BeginGroup();
+    ImGui::Checkbox("Trail", &trail);
+    ImGui::Checkbox("16-bit positions", &compactPositions);
+    if (ImGui::InputInt("Physics rate (Hz, 0 = every frame)", &physicsRate, 5, 30))
+    {
+        physicsRate = std::max(0, std::min(physicsRate, 1000));
+    }
+    drawDiagnosticsControls();
+    ImGui::Checkbox("Density view", &densityView);
+    if (densityView)
+    {
+        if (ImGui::InputFloat("Exposure", &densityExposure, 5.0f, 50.0f, "%.0f"))
+        {
+            densityExposure = std::max(1.0f, std::min(densityExposure, 10000.0f));
+        }
+    }
     ImGui::Checkbox("Walls", &walls);
+    ImGui::Checkbox("Collisions", &collisions);
+    if (collisions)
+    {
+        ImGui::Text("Other:");
+        ImGui::Checkbox("Merging", &merging);
+        if (ImGui::InputFloat("COR", &restitutionCoeff, 0.1f, 1.0f, "%.2f"))
+        {
+            restitutionCoeff = std::max(0.0f, std::min(restitutionCoeff, 1.0f));
+        }
+    }
+    ImGui::Checkbox("Record", &recording);
+    if (recording)
+    {
+        if (ImGui::InputInt("Every K steps", &recordInterval, 1, 10))
+        {
+            recordInterval = std::min(10000, std::max(recordInterval, 1));
+        }
+        ImGui::Checkbox("Drop frames when disk is slow", &dropFrames);
+    }
+    ImGui::Text("Generate:");
+    const char *distributionNames[] = {"Uniform", "Plummer", "Hernquist", "Exponential disk"};
+    if (ImGui::Combo("Distribution", &distribution, distributionNames, 4))
+    {
+        generatorScale = distribution == (int)sim::Distribution::Uniform ? 1000.0f : 300.0f;
+    }
+    if (ImGui::InputInt("Number of bodies", &generatorCount, 1000, 100000))
+    {
+        generatorCount = std::min(10000000, std::max(generatorCount, 1));
+    }
+    ImGui::InputInt("Seed", &generatorSeed);
+    if (ImGui::InputFloat("Scale", &generatorScale, 10.0f, 100.0f, "%.0f"))
+    {
+        generatorScale = std::max(10.0f, std::min(generatorScale, 100000.0f));
+    }
+    if (ImGui::Button("Generate"))
+    {
+        generator.generate((sim::Distribution)distribution, generatorCount, dimension, generatorScale,
+                           G, alpha, generatorSeed, bodies);
+        numOfBodies = generatorCount;
+        bodyIds.clear();
+    }
+    ImGui::Text("Import:");
+    ImGui::InputText("File", importPath, sizeof(importPath));
+    if (ImGui::Button("Load file"))
+    {
+        std::vector<sim::Body> loaded;
+        std::string error;
+        if (particleLoader.load(importPath, dimension, loaded, error))
+        {
+            bodies = std::move(loaded);
+            numOfBodies = bodies.size();
+            bodyIds.clear();
+            std::ostringstream status;
+            status.precision(3);
+            status << "Loaded " << numOfBodies << " bodies in " << particleLoader.getSeconds()
+                   << " s (" << particleLoader.getMegabytesPerSecond() << " MB/s)";
+            importStatus = status.str();
+            std::cout << importStatus << std::endl;
+        }
+        else
+        {
+            importStatus = "Import failed: " + error;
+            std::cerr << importStatus << std::endl;
+        }
+    }
+    if (!importStatus.empty())
+    {
+        ImGui::Text("%s", importStatus.c_str());
+    }
+    ImGui::EndGroup();
     ImGui::EndGroup();
     ImGui::End();
 }
 
-void drawInitThreeBody3D(GLFWwindow *window)
+void drawInitTracers()
 {
     ImGuiIO &io = ImGui::GetIO();
     ImVec2 window_size = ImVec2(io.DisplaySize.x, io.DisplaySize.y);
@@ -946,43 +1517,46 @@ void drawInitThreeBody3D(GLFWwindow *window)
     ImGui::BeginGroup();
     ImVec2 button_size = ImVec2(window_size.x / 4.0f, window_size.y / 16.0f);
     ImGui::SetCursorPos(ImVec2((window_size.x - button_size.x) / 2.0f, 20));
-    if (ImGui::Button("Start", button_size))
+    if (ImGui::Button("Start", button_size) || headless)
     {
+        if (bodyIds.size() != numOfBodies)
+        {
+            bodyIds = std::vector<int>(numOfBodies);
+            std::iota(bodyIds.begin(), bodyIds.end(), 0);
+        }
         vertices = std::vector<float>(numOfBodies * dimension);
         for (int i = 0; i < numOfBodies; i++)
         {
             for (int j = 0; j < dimension; j++)
             {
-                vertices[i * dimension + j] = bodies[i].coord[j] / 1000.0f;
+                vertices[i * dimension + j] = bodies[i].coord[j];
             }
         }
-
-        shaderProgram = gui::Shader("resources/shaders/vertexShaders/threeBodies3d.ver",
-                                    "resources/shaders/fragmentShaders/threeBodies3d.frag");
+        shaderProgram = gui::Shader("resources/shaders/vertexShaders/threeBodies2d.ver",
+                                    "resources/shaders/fragmentShaders/threeBodies2d.frag");
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glBindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STREAM_DRAW);
         glVertexAttribPointer(0, dimension, GL_FLOAT, GL_FALSE, dimension * sizeof(float), (void *)0);
         glEnableVertexAttribArray(0);
 
-        shaderProgramLine = gui::Shader("resources/shaders/vertexShaders/line.ver",
-                                        "resources/shaders/fragmentShaders/line.frag");
-        glGenVertexArrays(1, &lineVAO);
-        glGenBuffers(1, &lineVBO);
-        glBindVertexArray(lineVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, lineVBO);
-        glBufferData(GL_ARRAY_BUFFER, lineVertices.size() * sizeof(float), lineVertices.data(), GL_STATIC_DRAW);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+        tracerField.seedDisk(bodies, numOfTracers, tracerInnerRadius, tracerOuterRadius, G, 1);
+        std::vector<float> tracerVertices(tracerField.size() * 2);
+        tracerField.writePositions(tracerVertices.data(), 1.0f);
+        shaderProgramTracer = gui::Shader("resources/shaders/vertexShaders/bigNBodies.ver",
+                                          "resources/shaders/fragmentShaders/bigNBodies.frag");
+        glGenVertexArrays(1, &tracerVAO);
+        glGenBuffers(1, &tracerVBO);
+        glBindVertexArray(tracerVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, tracerVBO);
+        glBufferData(GL_ARRAY_BUFFER, tracerVertices.size() * sizeof(float), tracerVertices.data(), GL_DYNAMIC_DRAW);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
         glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
 
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindVertexArray(0);
-
-        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
         state = sim::States::Sim;
     }
     ImGui::EndGroup();
@@ -991,38 +1565,161 @@ void drawInitThreeBody3D(GLFWwindow *window)
     ImGui::SameLine();
     ImGui::SetCursorPos(ImVec2(window_size.x / 2.25f - button_size.x / 3.5f, 100.0f));
     ImGui::BeginGroup();
-    ImGui::Checkbox("Collisions", &collisions);
-    std::vector<const char *> inputFloatNames({"mass1", "x1", "y1", "z1", "vx1", "vy1", "vz1",
-                                               "mass2", "x2", "y2", "z2", "vx2", "vy2", "vz2",
-                                               "mass3", "x3", "y3", "z3", "vx3", "vy3", "vz3"});
-
-    for (int i = 0, j = 0; i < numOfBodies; i++)
+    ImGui::Checkbox("Fixed masses", &fixedMasses);
+    ImGui::Text("Massive bodies:");
+    if (ImGui::InputInt("Number of bodies", &numOfBodies, 1, 3))
     {
-        switch (i)
-        {
-        case 0:
-            ImGui::Text("First body:");
-            break;
-        case 1:
-            ImGui::Text("Second body:");
-            break;
-        case 2:
-            ImGui::Text("Third body:");
-            break;
-        }
-
-        if (ImGui::InputFloat(inputFloatNames[j++], &bodies[i].mass, 0.1f, 1.0f, "%.2f"))
+        numOfBodies = std::min(10, std::max(numOfBodies, 1));
+        while (bodies.size() < numOfBodies)
         {
-            bodies[i].mass = std::max(0.1f, std::min(bodies[i].mass, 1000.0f));
+            bodies.push_back(sim::Body(dimension));
         }
-        for (int k = 0; k < dimension; k++)
+        while (bodies.size() > numOfBodies)
         {
-            if (ImGui::InputFloat(inputFloatNames[j++], &bodies[i].coord[k], 0.1f, 1.0f, "%.2f"))
-            {
-                bodies[i].coord[k] = std::max(-1000.0f, std::min(bodies[i].coord[k], 1000.0f));
-            }
+            bodies.pop_back();
         }
-        for (int k = 0; k < dimension; k++)
+        selectedBody = 0;
+    }
+    if (ImGui::InputInt("Selected body", &selectedBody, 1, 3))
+    {
+        selectedBody = std::min(numOfBodies - 1, std::max(selectedBody, 0));
+    }
+    if (ImGui::InputFloat("mass", &bodies[selectedBody].mass, 0.1f, 1.0f, "%.2f"))
+    {
+        bodies[selectedBody].mass = std::max(0.1f, std::min(bodies[selectedBody].mass, 1000.0f));
+    }
+    if (ImGui::InputFloat("x", &bodies[selectedBody].coord[0], 0.1f, 1.0f, "%.2f"))
+    {
+        bodies[selectedBody].coord[0] = std::max(-1000.0f, std::min(bodies[selectedBody].coord[0], 1000.0f));
+    }
+    if (ImGui::InputFloat("y", &bodies[selectedBody].coord[1], 0.1f, 1.0f, "%.2f"))
+    {
+        bodies[selectedBody].coord[1] = std::max(-1000.0f, std::min(bodies[selectedBody].coord[1], 1000.0f));
+    }
+    if (ImGui::InputFloat("vx", &bodies[selectedBody].veloc[0], 0.1f, 1.0f, "%.2f"))
+    {
+        bodies[selectedBody].veloc[0] = std::max(-1000.0f, std::min(bodies[selectedBody].veloc[0], 1000.0f));
+    }
+    if (ImGui::InputFloat("vy", &bodies[selectedBody].veloc[1], 0.1f, 1.0f, "%.2f"))
+    {
+        bodies[selectedBody].veloc[1] = std::max(-1000.0f, std::min(bodies[selectedBody].veloc[1], 1000.0f));
+    }
+    ImGui::Text("Tracers:");
+    if (ImGui::InputInt("Number of tracers", &numOfTracers, 1000, 100000))
+    {
+        numOfTracers = std::min(2000000, std::max(numOfTracers, 1));
+    }
+    if (ImGui::InputFloat("Inner radius", &tracerInnerRadius, 10.0f, 100.0f, "%.2f"))
+    {
+        tracerInnerRadius = std::max(1.0f, std::min(tracerInnerRadius, tracerOuterRadius));
+    }
+    if (ImGui::InputFloat("Outer radius", &tracerOuterRadius, 10.0f, 100.0f, "%.2f"))
+    {
+        tracerOuterRadius = std::max(tracerInnerRadius, std::min(tracerOuterRadius, 2000.0f));
+    }
+    ImGui::EndGroup();
+    ImGui::EndGroup();
+    ImGui::End();
+}
+
+void drawInitThreeBody3D(GLFWwindow *window)
+{
+    ImGuiIO &io = ImGui::GetIO();
+    ImVec2 window_size = ImVec2(io.DisplaySize.x, io.DisplaySize.y);
+    ImVec2 window_pos = ImVec2(0.0f, 0.0f);
+    ImGui::SetNextWindowPos(window_pos, ImGuiCond_Always);
+    ImGui::SetNextWindowBgAlpha(0.0f);
+    ImGui::Begin("Controls", nullptr,
+                 ImGuiWindowFlags_NoDecoration |
+                     ImGuiWindowFlags_NoMove |
+                     ImGuiWindowFlags_NoSavedSettings |
+                     ImGuiWindowFlags_AlwaysAutoResize |
+                     ImGuiWindowFlags_NoBackground);
+    ImGui::BeginGroup();
+    ImVec2 button_size = ImVec2(window_size.x / 4.0f, window_size.y / 16.0f);
+    ImGui::SetCursorPos(ImVec2((window_size.x - button_size.x) / 2.0f, 20));
+    if (ImGui::Button("Start", button_size) || headless)
+    {
+        if (bodyIds.size() != numOfBodies)
+        {
+            bodyIds = std::vector<int>(numOfBodies);
+            std::iota(bodyIds.begin(), bodyIds.end(), 0);
+        }
+        vertices = std::vector<float>(numOfBodies * dimension);
+        for (int i = 0; i < numOfBodies; i++)
+        {
+            for (int j = 0; j < dimension; j++)
+            {
+                vertices[i * dimension + j] = bodies[i].coord[j];
+            }
+        }
+
+        shaderProgram = gui::Shader("resources/shaders/vertexShaders/threeBodies3d.ver",
+                                    "resources/shaders/fragmentShaders/threeBodies3d.frag");
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STREAM_DRAW);
+        glVertexAttribPointer(0, dimension, GL_FLOAT, GL_FALSE, dimension * sizeof(float), (void *)0);
+        glEnableVertexAttribArray(0);
+
+        shaderProgramLine = gui::Shader("resources/shaders/vertexShaders/line.ver",
+                                        "resources/shaders/fragmentShaders/line.frag");
+        glGenVertexArrays(1, &lineVAO);
+        glGenBuffers(1, &lineVBO);
+        glBindVertexArray(lineVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, lineVBO);
+        glBufferData(GL_ARRAY_BUFFER, lineVertices.size() * sizeof(float), lineVertices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        state = sim::States::Sim;
+    }
+    ImGui::EndGroup();
+    ImGui::SameLine();
+    ImGui::BeginGroup();
+    ImGui::SameLine();
+    ImGui::SetCursorPos(ImVec2(window_size.x / 2.25f - button_size.x / 3.5f, 100.0f));
+    ImGui::BeginGroup();
+    ImGui::Checkbox("Collisions", &collisions);
+    std::vector<const char *> inputFloatNames({"mass1", "x1", "y1", "z1", "vx1", "vy1", "vz1",
+                                               "mass2", "x2", "y2", "z2", "vx2", "vy2", "vz2",
+                                               "mass3", "x3", "y3", "z3", "vx3", "vy3", "vz3"});
+
+    for (int i = 0, j = 0; i < numOfBodies; i++)
+    {
+        switch (i)
+        {
+        case 0:
+            ImGui::Text("First body:");
+            break;
+        case 1:
+            ImGui::Text("Second body:");
+            break;
+        case 2:
+            ImGui::Text("Third body:");
+            break;
+        }
+
+        if (ImGui::InputFloat(inputFloatNames[j++], &bodies[i].mass, 0.1f, 1.0f, "%.2f"))
+        {
+            bodies[i].mass = std::max(0.1f, std::min(bodies[i].mass, 1000.0f));
+        }
+        for (int k = 0; k < dimension; k++)
+        {
+            if (ImGui::InputFloat(inputFloatNames[j++], &bodies[i].coord[k], 0.1f, 1.0f, "%.2f"))
+            {
+                bodies[i].coord[k] = std::max(-1000.0f, std::min(bodies[i].coord[k], 1000.0f));
+            }
+        }
+        for (int k = 0; k < dimension; k++)
         {
             if (ImGui::InputFloat(inputFloatNames[j++], &bodies[i].veloc[k], 0.1f, 1.0f, "%.2f"))
             {
@@ -1033,19 +1730,125 @@ void drawInitThreeBody3D(GLFWwindow *window)
     if (collisions)
     {
         ImGui::Text("Other:");
+        ImGui::Checkbox("Merging", &merging);
         if (ImGui::InputFloat("COR", &restitutionCoeff, 0.1f, 1.0f, "%.2f"))
         {
             restitutionCoeff = std::max(0.0f, std::min(restitutionCoeff, 1.0f));
         }
     }
+    drawEnsembleControls();
     ImGui::EndGroup();
     ImGui::EndGroup();
 
     ImGui::End();
 }
+void drawInitNBodyBig3D(GLFWwindow *window)
+{
+    ImGuiIO &io = ImGui::GetIO();
+    ImVec2 window_size = ImVec2(io.DisplaySize.x, io.DisplaySize.y);
+    ImVec2 window_pos = ImVec2(0.0f, 0.0f);
+    ImGui::SetNextWindowPos(window_pos, ImGuiCond_Always);
+    ImGui::SetNextWindowBgAlpha(0.0f);
+    ImGui::Begin("Controls", nullptr,
+                 ImGuiWindowFlags_NoDecoration |
+                     ImGuiWindowFlags_NoMove |
+                     ImGuiWindowFlags_NoSavedSettings |
+                     ImGuiWindowFlags_AlwaysAutoResize |
+                     ImGuiWindowFlags_NoBackground);
+    ImGui::BeginGroup();
+    ImVec2 button_size = ImVec2(window_size.x / 3.0f, window_size.y / 12.0f);
+    ImGui::SetCursorPos(ImVec2((window_size.x - button_size.x) / 2.0f, window_size.y / 2.0f - button_size.y));
+    if (ImGui::Button("Start", button_size) || headless)
+    {
+        if (bodyIds.size() != numOfBodies)
+        {
+            bodyIds = std::vector<int>(numOfBodies);
+            std::iota(bodyIds.begin(), bodyIds.end(), 0);
+        }
+
+        // Points are x, y, z and the number of bodies they stand for; the
+        // buffer is refilled with the culled set every frame.
+        shaderProgram = gui::Shader("resources/shaders/vertexShaders/bigNBodies3d.ver",
+                                    "resources/shaders/fragmentShaders/threeBodies3d.frag");
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, (size_t)numOfBodies * 4 * sizeof(float), NULL, GL_STREAM_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+
+        shaderProgramLine = gui::Shader("resources/shaders/vertexShaders/line.ver",
+                                        "resources/shaders/fragmentShaders/line.frag");
+        glGenVertexArrays(1, &lineVAO);
+        glGenBuffers(1, &lineVBO);
+        glBindVertexArray(lineVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, lineVBO);
+        glBufferData(GL_ARRAY_BUFFER, lineVertices.size() * sizeof(float), lineVertices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+
+        simStep = 0;
+        startDiagnostics();
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        state = sim::States::Sim;
+    }
+    ImGui::SameLine();
+    ImGui::SetCursorPos(ImVec2((window_size.x + button_size.x) / 2.75f, window_size.y / 2.0f - button_size.y + 100));
+    ImGui::BeginGroup();
+    if (ImGui::InputFloat("Merge cells under (px)", &lodPixels, 0.5f, 2.0f, "%.1f"))
+    {
+        lodPixels = std::max(0.0f, std::min(lodPixels, 64.0f));
+    }
+    drawDiagnosticsControls();
+    ImGui::Checkbox("Collisions", &collisions);
+    if (collisions)
+    {
+        ImGui::Text("Other:");
+        ImGui::Checkbox("Merging", &merging);
+        if (ImGui::InputFloat("COR", &restitutionCoeff, 0.1f, 1.0f, "%.2f"))
+        {
+            restitutionCoeff = std::max(0.0f, std::min(restitutionCoeff, 1.0f));
+        }
+    }
+    ImGui::Text("Generate:");
+    const char *distributionNames[] = {"Uniform", "Plummer", "Hernquist", "Exponential disk"};
+    if (ImGui::Combo("Distribution", &distribution, distributionNames, 4))
+    {
+        generatorScale = distribution == (int)sim::Distribution::Uniform ? 1000.0f : 300.0f;
+    }
+    if (ImGui::InputInt("Number of bodies", &generatorCount, 1000, 100000))
+    {
+        generatorCount = std::min(10000000, std::max(generatorCount, 1));
+    }
+    ImGui::InputInt("Seed", &generatorSeed);
+    if (ImGui::InputFloat("Scale", &generatorScale, 10.0f, 100.0f, "%.0f"))
+    {
+        generatorScale = std::max(10.0f, std::min(generatorScale, 100000.0f));
+    }
+    if (ImGui::Button("Generate"))
+    {
+        generator.generate((sim::Distribution)distribution, generatorCount, dimension, generatorScale,
+                           G, alpha, generatorSeed, bodies);
+        numOfBodies = generatorCount;
+        bodyIds.clear();
+    }
+    ImGui::EndGroup();
+    ImGui::EndGroup();
+    ImGui::End();
+}
+
 
 void drawSimThreeBody2D(GLFWwindow *window)
 {
+    sim::TraceScope trace("drawSimThreeBody2D");
     if (infos)
     {
         ImGuiIO &io = ImGui::GetIO();
@@ -1062,10 +1865,16 @@ void drawSimThreeBody2D(GLFWwindow *window)
         for (int i = 0; i < bodies.size(); i++)
         {
             ImGui::Text("x%d=%.2f y%d=%.2f\nvx%d=%.2f vy%d=%.2f",
-                        i + 1, bodies[i].coord[0],
-                        i + 1, bodies[i].coord[1],
-                        i + 1, bodies[i].veloc[0],
-                        i + 1, bodies[i].veloc[1]);
+                        bodyIds[i] + 1, bodies[i].coord[0],
+                        bodyIds[i] + 1, bodies[i].coord[1],
+                        bodyIds[i] + 1, bodies[i].veloc[0],
+                        bodyIds[i] + 1, bodies[i].veloc[1]);
+        }
+        if (regularization.getCappedSteps() > 0)
+        {
+            ImGui::Text("Regularization capped %d times\n%.3g s carried, %.3g s lost",
+                        regularization.getCappedSteps(), regularization.getShortfall(),
+                        regularization.getLostTime());
         }
         ImGui::End();
     }
@@ -1074,117 +1883,75 @@ void drawSimThreeBody2D(GLFWwindow *window)
     {
         shaderProgramTrail.use();
         shaderProgramTrail.uniform1i("uMaxIndex", trailLength);
+        shaderProgramTrail.uniform1i("uHead", trailHead);
         shaderProgramTrail.uniform1f("radius", radius);
+        shaderProgramTrail.uniform1f("scale", worldScale);
         glBindVertexArray(trailVAO);
         glDrawArrays(GL_POINTS, 0, trailVertices.size());
     }
 
     shaderProgram.use();
     shaderProgram.uniform1f("radius", radius);
+    shaderProgram.uniform1f("scale", worldScale);
     glBindVertexArray(VAO);
     glDrawArrays(GL_POINTS, 0, numOfBodies);
 
-    std::vector<std::vector<double>> a(numOfBodies, std::vector<double>(dimension, 0));
-    for (int i = 0; i < numOfBodies; i++)
+    bool regularized = regularization.closeEncounter(bodies);
+    if (regularized)
     {
-        for (int j = 0; j < numOfBodies; j++)
+        regularization.advance(bodies, deltaTime);
+    }
+    else
+    {
+        regularization.endEncounter();
+        std::vector<std::vector<double>> a(numOfBodies, std::vector<double>(dimension, 0));
+        for (int i = 0; i < numOfBodies; i++)
         {
-            if (i != j)
+            for (int j = 0; j < numOfBodies; j++)
             {
-                std::vector<double> dCoord(dimension);
-                double distSqr = 0;
-                for (int k = 0; k < dimension; k++)
-                {
-                    dCoord[k] = bodies[j].coord[k] - bodies[i].coord[k];
-                    distSqr += dCoord[k] * dCoord[k];
-                }
-                distSqr += alpha * alpha;
-                double invDist = 1.0 / sqrt(distSqr);
-                double invDist3 = invDist * invDist * invDist;
-                for (int k = 0; k < dimension; k++)
+                if (i != j)
                 {
-                    a[i][k] += G * bodies[j].mass * dCoord[k] * invDist3;
+                    std::vector<double> dCoord(dimension);
+                    double distSqr = 0;
+                    for (int k = 0; k < dimension; k++)
+                    {
+                        dCoord[k] = bodies[j].coord[k] - bodies[i].coord[k];
+                        distSqr += dCoord[k] * dCoord[k];
+                    }
+                    distSqr += alpha * alpha;
+                    double invDist = 1.0 / sqrt(distSqr);
+                    double invDist3 = invDist * invDist * invDist;
+                    for (int k = 0; k < dimension; k++)
+                    {
+                        a[i][k] += G * bodies[j].mass * dCoord[k] * invDist3;
+                    }
                 }
             }
         }
-    }
 
-    for (int i = 0; i < numOfBodies; i++)
-    {
-        for (int j = 0; j < dimension; j++)
+        for (int i = 0; i < numOfBodies; i++)
         {
-            bodies[i].veloc[j] += a[i][j] * deltaTime;
+            for (int j = 0; j < dimension; j++)
+            {
+                bodies[i].veloc[j] += a[i][j] * deltaTime;
+            }
         }
     }
 
-    if (collisions)
+    if (collisions && !merging)
     {
-        for (int i = 0; i < numOfBodies; i++)
+        collisionSolver.resolve(bodies, radius, restitutionCoeff, numOfBodies);
+    }
+
+    for (int i = 0; i < numOfBodies; i++)
+    {
+        if (!regularized)
         {
-            for (int k = i + 1; k < numOfBodies; k++)
+            for (int j = 0; j < dimension; j++)
             {
-                std::vector<float> n(dimension, 0.0f);
-                float distSqr = 0.0f;
-                for (int l = 0; l < dimension; l++)
-                {
-                    n[l] = bodies[i].coord[l] - bodies[k].coord[l];
-                    distSqr += n[l] * n[l];
-                }
-
-                float rSum = 2 * radius;
-                if (distSqr > rSum * rSum)
-                {
-                    continue;
-                }
-
-                float dist = sqrt(distSqr);
-
-                std::vector<float> nNormal(dimension);
-                for (int l = 0; l < dimension; l++)
-                {
-                    nNormal[l] = n[l] / dist;
-                }
-
-                float mi = bodies[i].mass;
-                float mk = bodies[k].mass;
-
-                std::vector<float> vRel(dimension);
-                for (int l = 0; l < dimension; l++)
-                {
-                    vRel[l] = bodies[i].veloc[l] - bodies[k].veloc[l];
-                }
-
-                float vRelNormal = dotProduct(dimension, vRel, nNormal);
-                if (vRelNormal > 0)
-                {
-                    continue;
-                }
-
-                float impulse = -(1.0f + restitutionCoeff) * vRelNormal / (1.0f / mi + 1.0f / mk);
-
-                for (int l = 0; l < dimension; l++)
-                {
-                    bodies[i].veloc[l] += impulse / mi * nNormal[l];
-                    bodies[k].veloc[l] -= impulse / mk * nNormal[l];
-                }
-
-                float overlap = 0.5f * (rSum - dist);
-                for (int l = 0; l < dimension; l++)
-                {
-                    float correction = overlap * nNormal[l];
-                    bodies[i].coord[l] += correction * (mk / (mi + mk));
-                    bodies[k].coord[l] -= correction * (mi / (mi + mk));
-                }
-            }
-        }
-    }
-
-    for (int i = 0; i < numOfBodies; i++)
-    {
-        for (int j = 0; j < dimension; j++)
-        {
-            bodies[i].coord[j] += bodies[i].veloc[j] * deltaTime;
-        }
+                bodies[i].coord[j] += bodies[i].veloc[j] * deltaTime;
+            }
+        }
 
         if (walls)
         {
@@ -1198,47 +1965,25 @@ void drawSimThreeBody2D(GLFWwindow *window)
             if (bodies[i].coord[1] - radius < -w && bodies[i].veloc[1] < 0)
                 bodies[i].veloc[1] *= -1;
         }
-
-        vertices[i * dimension] = bodies[i].coord[0] / 1000.0f;
-        vertices[i * dimension + 1] = bodies[i].coord[1] / 1000.0f;
     }
 
-    if (trail)
+    if (collisions && merging)
     {
-        for (int i = 0; i < numOfBodies; i++)
-        {
-            for (int j = 0; j < trailLength - 1; j++)
-            {
-                trailVertices[i * trailLength + j].x = trailVertices[i * trailLength + j + 1].x;
-                trailVertices[i * trailLength + j].y = trailVertices[i * trailLength + j + 1].y;
-            }
-            trailVertices[(i + 1) * trailLength - 1].x = vertices[i * 2];
-            trailVertices[(i + 1) * trailLength - 1].y = vertices[i * 2 + 1];
-        }
+        mergeBodies();
     }
 
     if (trail)
     {
-        glBindBuffer(GL_ARRAY_BUFFER, trailVBO);
-        void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, trailVertices.size() * sizeof(trailStruct), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
-        if (ptr != NULL)
-        {
-            memcpy(ptr, trailVertices.data(), trailVertices.size() * sizeof(trailStruct));
-            glUnmapBuffer(GL_ARRAY_BUFFER);
-        }
+        pushTrail(numOfBodies);
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(float), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
-    if (ptr != NULL)
-    {
-        memcpy(ptr, vertices.data(), vertices.size() * sizeof(float));
-        glUnmapBuffer(GL_ARRAY_BUFFER);
-    }
+
+    uploadPositions();
 }
 
 void drawSimTwoFixedBody(GLFWwindow *window)
 {
+    sim::TraceScope trace("drawSimTwoFixedBody");
     if (infos)
     {
         ImGuiIO &io = ImGui::GetIO();
@@ -1263,12 +2008,15 @@ void drawSimTwoFixedBody(GLFWwindow *window)
     {
         shaderProgramTrail.use();
         shaderProgramTrail.uniform1i("uMaxIndex", trailLength);
+        shaderProgramTrail.uniform1i("uHead", trailHead);
         shaderProgramTrail.uniform1f("radius", radius);
+        shaderProgramTrail.uniform1f("scale", worldScale);
         glBindVertexArray(trailVAO);
         glDrawArrays(GL_POINTS, 0, trailVertices.size());
     }
     shaderProgram.use();
     shaderProgram.uniform1f("radius", radius);
+    shaderProgram.uniform1f("scale", worldScale);
     glBindVertexArray(VAO);
     glDrawArrays(GL_POINTS, 0, numOfBodies);
 
@@ -1304,95 +2052,20 @@ void drawSimTwoFixedBody(GLFWwindow *window)
 
     if (collisions)
     {
-        int i = 0;
-        for (int k = i + 1; k < numOfBodies; k++)
-        {
-            std::vector<float> n(dimension, 0.0f);
-            float distSqr = 0.0f;
-            for (int l = 0; l < dimension; l++)
-            {
-                n[l] = bodies[i].coord[l] - bodies[k].coord[l];
-                distSqr += n[l] * n[l];
-            }
-
-            float rSum = 2 * radius;
-            if (distSqr > rSum * rSum)
-            {
-                continue;
-            }
-
-            float dist = sqrt(distSqr);
-
-            std::vector<float> nNormal(dimension);
-            for (int l = 0; l < dimension; l++)
-            {
-                nNormal[l] = n[l] / dist;
-            }
-
-            float mi = bodies[i].mass;
-            float mk = bodies[k].mass;
-
-            std::vector<float> vRel(dimension);
-            for (int l = 0; l < dimension; l++)
-            {
-                vRel[l] = bodies[i].veloc[l] - bodies[k].veloc[l];
-            }
-
-            float vRelNormal = dotProduct(dimension, vRel, nNormal);
-            if (vRelNormal > 0)
-            {
-                continue;
-            }
-
-            float impulse = -(1.0f + restitutionCoeff) * vRelNormal / (1.0f / mi);
-
-            for (int l = 0; l < dimension; l++)
-            {
-                bodies[i].veloc[l] += impulse / mi * nNormal[l];
-            }
-
-            float overlap = rSum - dist;
-            for (int l = 0; l < dimension; l++)
-            {
-                bodies[i].coord[l] += overlap * nNormal[l];
-            }
-        }
+        collisionSolver.resolve(bodies, radius, restitutionCoeff, 1);
     }
 
     if (trail)
     {
-        for (int j = 0; j < trailLength - 1; j++)
-        {
-            trailVertices[j].x = trailVertices[j + 1].x;
-            trailVertices[j].y = trailVertices[j + 1].y;
-        }
-        trailVertices[trailLength - 1].x = vertices[0];
-        trailVertices[trailLength - 1].y = vertices[1];
+        pushTrail(1);
     }
-    vertices[0] = bodies[0].coord[0] / 1000.0f;
-    vertices[1] = bodies[0].coord[1] / 1000.0f;
 
-    if (trail)
-    {
-        glBindBuffer(GL_ARRAY_BUFFER, trailVBO);
-        void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, trailVertices.size() * sizeof(trailStruct), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
-        if (ptr != NULL)
-        {
-            memcpy(ptr, trailVertices.data(), trailVertices.size() * sizeof(trailStruct));
-            glUnmapBuffer(GL_ARRAY_BUFFER);
-        }
-    }
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(float), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
-    if (ptr != NULL)
-    {
-        memcpy(ptr, vertices.data(), vertices.size() * sizeof(float));
-        glUnmapBuffer(GL_ARRAY_BUFFER);
-    }
+    uploadPositions();
 }
 
 void drawSimNBodySmall(GLFWwindow *window)
 {
+    sim::TraceScope trace("drawSimNBodySmall");
     if (infos)
     {
         ImGuiIO &io = ImGui::GetIO();
@@ -1409,10 +2082,10 @@ void drawSimNBodySmall(GLFWwindow *window)
         for (int i = 0; i < bodies.size(); i++)
         {
             ImGui::Text("x%d=%.2f y%d=%.2f\nvx%d=%.2f vy%d=%.2f",
-                        i + 1, bodies[i].coord[0],
-                        i + 1, bodies[i].coord[1],
-                        i + 1, bodies[i].veloc[0],
-                        i + 1, bodies[i].veloc[1]);
+                        bodyIds[i] + 1, bodies[i].coord[0],
+                        bodyIds[i] + 1, bodies[i].coord[1],
+                        bodyIds[i] + 1, bodies[i].veloc[0],
+                        bodyIds[i] + 1, bodies[i].veloc[1]);
         }
         ImGui::End();
     }
@@ -1420,12 +2093,15 @@ void drawSimNBodySmall(GLFWwindow *window)
     {
         shaderProgramTrail.use();
         shaderProgramTrail.uniform1i("uMaxIndex", trailLength);
+        shaderProgramTrail.uniform1i("uHead", trailHead);
         shaderProgramTrail.uniform1f("radius", radius);
+        shaderProgramTrail.uniform1f("scale", worldScale);
         glBindVertexArray(trailVAO);
         glDrawArrays(GL_POINTS, 0, trailVertices.size());
     }
     shaderProgram.use();
     shaderProgram.uniform1f("radius", radius);
+    shaderProgram.uniform1f("scale", worldScale);
     glBindVertexArray(VAO);
     glDrawArrays(GL_POINTS, 0, numOfBodies);
 
@@ -1452,66 +2128,9 @@ void drawSimNBodySmall(GLFWwindow *window)
             }
         }
     }
-    if (collisions)
+    if (collisions && !merging)
     {
-        for (int i = 0; i < numOfBodies; i++)
-        {
-            for (int k = i + 1; k < numOfBodies; k++)
-            {
-                std::vector<float> n(dimension, 0.0f);
-                float distSqr = 0.0f;
-                for (int l = 0; l < dimension; l++)
-                {
-                    n[l] = bodies[i].coord[l] - bodies[k].coord[l];
-                    distSqr += n[l] * n[l];
-                }
-
-                float rSum = 2 * radius;
-                if (distSqr > rSum * rSum)
-                {
-                    continue;
-                }
-
-                float dist = sqrt(distSqr);
-
-                std::vector<float> nNormal(dimension);
-                for (int l = 0; l < dimension; l++)
-                {
-                    nNormal[l] = n[l] / dist;
-                }
-
-                float mi = bodies[i].mass;
-                float mk = bodies[k].mass;
-
-                std::vector<float> vRel(dimension);
-                for (int l = 0; l < dimension; l++)
-                {
-                    vRel[l] = bodies[i].veloc[l] - bodies[k].veloc[l];
-                }
-
-                float vRelNormal = dotProduct(dimension, vRel, nNormal);
-                if (vRelNormal > 0)
-                {
-                    continue;
-                }
-
-                float impulse = -(1.0f + restitutionCoeff) * vRelNormal / (1.0f / mi + 1.0f / mk);
-
-                for (int l = 0; l < dimension; l++)
-                {
-                    bodies[i].veloc[l] += impulse / mi * nNormal[l];
-                    bodies[k].veloc[l] -= impulse / mk * nNormal[l];
-                }
-
-                float overlap = 0.5f * (rSum - dist);
-                for (int l = 0; l < dimension; l++)
-                {
-                    float correction = overlap * nNormal[l];
-                    bodies[i].coord[l] += correction * (mk / (mi + mk));
-                    bodies[k].coord[l] -= correction * (mi / (mi + mk));
-                }
-            }
-        }
+        collisionSolver.resolve(bodies, radius, restitutionCoeff, numOfBodies);
     }
     for (int i = 0; i < numOfBodies; i++)
     {
@@ -1532,61 +2151,122 @@ void drawSimNBodySmall(GLFWwindow *window)
                 if (bodies[i].coord[1] - radius < -w && bodies[i].veloc[1] < 0)
                     bodies[i].veloc[1] *= -1;
             }
-            vertices[i * dimension + j] = bodies[i].coord[j] / 1000.0f;
         }
     }
 
-    if (trail)
+    if (collisions && merging)
     {
-        for (int i = 0; i < numOfBodies; i++)
-        {
-            for (int j = 0; j < trailLength - 1; j++)
-            {
-                trailVertices[i * trailLength + j].x = trailVertices[i * trailLength + j + 1].x;
-                trailVertices[i * trailLength + j].y = trailVertices[i * trailLength + j + 1].y;
-            }
-            trailVertices[(i + 1) * trailLength - 1].x = vertices[i * 2];
-            trailVertices[(i + 1) * trailLength - 1].y = vertices[i * 2 + 1];
-        }
+        mergeBodies();
     }
 
     if (trail)
     {
-        glBindBuffer(GL_ARRAY_BUFFER, trailVBO);
-        void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, trailVertices.size() * sizeof(trailStruct), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
-        if (ptr != NULL)
+        pushTrail(numOfBodies);
+    }
+
+    uploadPositions();
+}
+
+void drawSimNBodyBig(GLFWwindow *window)
+{
+    sim::TraceScope trace("drawSimNBodyBig");
+    if (physicsRate > 0)
+    {
+        // Physics runs at its own fixed rate; the shaders draw the bodies
+        // renderLag of a step behind the latest state, blended with the
+        // previous one kept in prevVBO.
+        double step = 1.0 / physicsRate;
+        physicsAccumulator += deltaTime;
+        int steps = 0;
+        while (physicsAccumulator >= step && steps < maxStepsPerFrame)
         {
-            memcpy(ptr, trailVertices.data(), trailVertices.size() * sizeof(trailStruct));
-            glUnmapBuffer(GL_ARRAY_BUFFER);
+            savePreviousPositions();
+            stepNBodyBig(step);
+            physicsAccumulator -= step;
+            steps++;
         }
+        physicsAccumulator = std::min(physicsAccumulator, step);
+        renderLag = 1.0f - physicsAccumulator / step;
     }
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(float), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
-    if (ptr != NULL)
+    if (trail)
     {
-        memcpy(ptr, vertices.data(), vertices.size() * sizeof(float));
-        glUnmapBuffer(GL_ARRAY_BUFFER);
+        shaderProgramTrail.use();
+        shaderProgramTrail.uniform1f("radius", radius);
+        setPositionUniforms(shaderProgramTrail);
+        shaderProgramTrail.uniform1i("uMaxIndex", gpuTrailLength);
+        shaderProgramTrail.uniform1i("uHead", trailHead);
+        shaderProgramTrail.uniform1i("uNumBodies", numOfBodies);
+        shaderProgramTrail.uniform1i("uTrail", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, trailTexture);
+        glBindVertexArray(trailVAO);
+        glDrawArraysInstanced(GL_POINTS, 0, numOfBodies, gpuTrailLength);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+    if (densityView)
+    {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        gui::Shader &splatShader = densityRenderer.begin(width, height);
+        setPositionUniforms(splatShader);
+        splatShader.uniform1f("lag", renderLag);
+        glBindVertexArray(VAO);
+        glDrawArrays(GL_POINTS, 0, numOfBodies);
+        densityRenderer.end(densityExposure);
+    }
+    else
+    {
+        shaderProgram.use();
+        shaderProgram.uniform1f("radius", radius);
+        setPositionUniforms(shaderProgram);
+        shaderProgram.uniform1f("lag", renderLag);
+        glBindVertexArray(VAO);
+        glDrawArrays(GL_POINTS, 0, numOfBodies);
+    }
+    if (physicsRate == 0)
+    {
+        stepNBodyBig(deltaTime);
     }
 }
 
-void drawSimNBodyBig(GLFWwindow *window)
+void stepNBodyBig(double dt)
 {
-    shaderProgram.use();
-    shaderProgram.uniform1f("radius", radius);
-    glBindVertexArray(VAO);
-    glDrawArrays(GL_POINTS, 0, numOfBodies);
+    profiler.begin(sim::Phase::TreeBuild);
     sim::QuadTree *qt = new sim::QuadTree(radius, -1000.0, 1000.0, 1000.0, -1000.0);
     for (int i = 0; i < numOfBodies; i++)
     {
         qt->addBody(bodies[i]);
     }
+    profiler.end(sim::Phase::TreeBuild);
+
+    // The tree holds copies of the bodies, so every force can be taken before
+    // any body moves.
+    profiler.begin(sim::Phase::ForceWalk);
+    unsigned long long interactions = 0;
+    accelerations.resize(numOfBodies * dimension);
+    potentials.resize(numOfBodies);
     for (int i = 0; i < numOfBodies; i++)
     {
-        std::vector<float> a = qt->calForce(bodies[i], G, alpha, theta);
+        float potential = 0.0f;
+        std::vector<float> a = qt->calForce(bodies[i], G, alpha, theta, interactions, potential);
         for (int j = 0; j < dimension; j++)
         {
-            bodies[i].veloc[j] += a[j] * deltaTime;
-            bodies[i].coord[j] += bodies[i].veloc[j] * deltaTime;
+            accelerations[i * dimension + j] = a[j];
+        }
+        potentials[i] = potential;
+    }
+    profiler.end(sim::Phase::ForceWalk);
+    profiler.addInteractions(interactions);
+    delete qt;
+    diagnostics.step(dt, bodies, potentials);
+
+    profiler.begin(sim::Phase::Integration);
+    for (int i = 0; i < numOfBodies; i++)
+    {
+        for (int j = 0; j < dimension; j++)
+        {
+            bodies[i].veloc[j] += accelerations[i * dimension + j] * dt;
+            bodies[i].coord[j] += bodies[i].veloc[j] * dt;
             if (walls)
             {
                 float w = ImGui::GetWindowWidth() * 2.5f;
@@ -1601,26 +2281,126 @@ void drawSimNBodyBig(GLFWwindow *window)
             }
         }
     }
-    for (int i = 0; i < numOfBodies; i++)
+    profiler.end(sim::Phase::Integration);
+    profiler.begin(sim::Phase::Collisions);
+    if (collisions && !merging)
     {
-        for (int j = 0; j < dimension; j++)
+        collisionSolver.resolve(bodies, radius, restitutionCoeff, numOfBodies);
+    }
+    if (collisions && merging)
+    {
+        mergeBodies();
+    }
+    profiler.end(sim::Phase::Collisions);
+
+    uploadPositions();
+    if (trail)
+    {
+        // Append the new positions to the trail ring without a CPU round trip.
+        profiler.begin(sim::Phase::Upload);
+        glBindBuffer(GL_COPY_READ_BUFFER, VBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, trailVBO);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                            trailHead * positionBytes(numOfBodies), positionBytes(numOfBodies));
+        trailHead = (trailHead + 1) % gpuTrailLength;
+        profiler.end(sim::Phase::Upload);
+    }
+    finishStep();
+}
+
+void drawSimTracers(GLFWwindow *window)
+{
+    sim::TraceScope trace("drawSimTracers");
+    if (infos)
+    {
+        ImVec2 window_pos = ImVec2(0.0f, 0.0f);
+        ImGui::SetNextWindowPos(window_pos, ImGuiCond_Always);
+        ImGui::SetNextWindowBgAlpha(0.0f);
+        ImGui::Begin("Infos", nullptr,
+                     ImGuiWindowFlags_NoDecoration |
+                         ImGuiWindowFlags_NoMove |
+                         ImGuiWindowFlags_NoSavedSettings |
+                         ImGuiWindowFlags_AlwaysAutoResize |
+                         ImGuiWindowFlags_NoBackground);
+        ImGui::Text("Tracers: %d", tracerField.size());
+        for (int i = 0; i < bodies.size(); i++)
         {
-            vertices[i * dimension + j] = bodies[i].coord[j] / 1000.0f;
+            ImGui::Text("x%d=%.2f y%d=%.2f\nvx%d=%.2f vy%d=%.2f",
+                        bodyIds[i] + 1, bodies[i].coord[0],
+                        bodyIds[i] + 1, bodies[i].coord[1],
+                        bodyIds[i] + 1, bodies[i].veloc[0],
+                        bodyIds[i] + 1, bodies[i].veloc[1]);
         }
+        ImGui::End();
     }
-    delete qt;
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(float), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    // The program is shared with Large n Bodies, which leaves its own offset
+    // and lag set; the tracers are full floats with no previous positions.
+    shaderProgramTracer.use();
+    shaderProgramTracer.uniform1f("radius", tracerRadius);
+    shaderProgramTracer.uniform1f("scale", worldScale);
+    shaderProgramTracer.uniform2f("offset", 0.0f, 0.0f);
+    shaderProgramTracer.uniform1f("lag", 0.0f);
+    glBindVertexArray(tracerVAO);
+    glDrawArrays(GL_POINTS, 0, tracerField.size());
+
+    shaderProgram.use();
+    shaderProgram.uniform1f("radius", radius);
+    shaderProgram.uniform1f("scale", worldScale);
+    glBindVertexArray(VAO);
+    glDrawArrays(GL_POINTS, 0, numOfBodies);
+
+    tracerField.step(bodies, G, alpha, deltaTime);
+
+    if (!fixedMasses)
+    {
+        std::vector<std::vector<double>> a(numOfBodies, std::vector<double>(dimension, 0));
+        for (int i = 0; i < numOfBodies; i++)
+        {
+            for (int j = 0; j < numOfBodies; j++)
+            {
+                if (i != j)
+                {
+                    std::vector<double> dCoord(dimension);
+                    double distSqr = alpha * alpha;
+                    for (int k = 0; k < dimension; k++)
+                    {
+                        dCoord[k] = bodies[j].coord[k] - bodies[i].coord[k];
+                        distSqr += dCoord[k] * dCoord[k];
+                    }
+                    double invDist = 1.0 / sqrt(distSqr);
+                    double invDist3 = invDist * invDist * invDist;
+                    for (int k = 0; k < dimension; k++)
+                    {
+                        a[i][k] += G * bodies[j].mass * dCoord[k] * invDist3;
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < numOfBodies; i++)
+        {
+            for (int j = 0; j < dimension; j++)
+            {
+                bodies[i].veloc[j] += a[i][j] * deltaTime;
+                bodies[i].coord[j] += bodies[i].veloc[j] * deltaTime;
+            }
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, tracerVBO);
+    void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, tracerField.size() * 2 * sizeof(float), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
     if (ptr != NULL)
     {
-        memcpy(ptr, vertices.data(), vertices.size() * sizeof(float));
+        tracerField.writePositions((float *)ptr, 1.0f);
         glUnmapBuffer(GL_ARRAY_BUFFER);
     }
+
+    uploadPositions();
 }
 
 void drawSimThreeBody3D(GLFWwindow *window)
 {
+    sim::TraceScope trace("drawSimThreeBody3D");
     if (infos)
     {
         ImGuiIO &io = ImGui::GetIO();
@@ -1642,12 +2422,18 @@ void drawSimThreeBody3D(GLFWwindow *window)
         for (int i = 0; i < bodies.size(); i++)
         {
             ImGui::Text("x%d=%.2f y%d=%.2f z%d=%.2f\nvx%d=%.2f vy%d=%.2f vz%d=%.2f",
-                        i + 1, bodies[i].coord[0],
-                        i + 1, bodies[i].coord[1],
-                        i + 1, bodies[i].coord[2],
-                        i + 1, bodies[i].veloc[0],
-                        i + 1, bodies[i].veloc[1],
-                        i + 1, bodies[i].veloc[2]);
+                        bodyIds[i] + 1, bodies[i].coord[0],
+                        bodyIds[i] + 1, bodies[i].coord[1],
+                        bodyIds[i] + 1, bodies[i].coord[2],
+                        bodyIds[i] + 1, bodies[i].veloc[0],
+                        bodyIds[i] + 1, bodies[i].veloc[1],
+                        bodyIds[i] + 1, bodies[i].veloc[2]);
+        }
+        if (regularization.getCappedSteps() > 0)
+        {
+            ImGui::Text("Regularization capped %d times\n%.3g s carried, %.3g s lost",
+                        regularization.getCappedSteps(), regularization.getShortfall(),
+                        regularization.getLostTime());
         }
         ImGui::End();
     }
@@ -1661,140 +2447,524 @@ void drawSimThreeBody3D(GLFWwindow *window)
 
     shaderProgram.use();
     shaderProgram.uniform1f("radius", radius);
+    shaderProgram.uniform1f("scale", worldScale);
     shaderProgram.uniform4mat("projection", projection);
     shaderProgram.uniform4mat("view", view);
     glBindVertexArray(VAO);
     glDrawArrays(GL_POINTS, 0, numOfBodies);
 
-    std::vector<std::vector<double>> a(numOfBodies, std::vector<double>(dimension, 0));
-    for (int i = 0; i < numOfBodies; i++)
+    bool regularized = regularization.closeEncounter(bodies);
+    if (regularized)
     {
-        for (int j = 0; j < numOfBodies; j++)
+        regularization.advance(bodies, deltaTime);
+    }
+    else
+    {
+        regularization.endEncounter();
+        std::vector<std::vector<double>> a(numOfBodies, std::vector<double>(dimension, 0));
+        for (int i = 0; i < numOfBodies; i++)
         {
-            if (i != j)
+            for (int j = 0; j < numOfBodies; j++)
             {
-                std::vector<double> dCoord(dimension);
-                double distSqr = alpha * alpha;
-                for (int k = 0; k < dimension; k++)
-                {
-                    dCoord[k] = bodies[j].coord[k] - bodies[i].coord[k];
-                    distSqr += dCoord[k] * dCoord[k];
-                }
-                double invDist = 1.0 / sqrt(distSqr);
-                double invDist3 = invDist * invDist * invDist;
-                for (int k = 0; k < dimension; k++)
+                if (i != j)
                 {
-                    a[i][k] += G * bodies[j].mass * dCoord[k] * invDist3;
+                    std::vector<double> dCoord(dimension);
+                    double distSqr = alpha * alpha;
+                    for (int k = 0; k < dimension; k++)
+                    {
+                        dCoord[k] = bodies[j].coord[k] - bodies[i].coord[k];
+                        distSqr += dCoord[k] * dCoord[k];
+                    }
+                    double invDist = 1.0 / sqrt(distSqr);
+                    double invDist3 = invDist * invDist * invDist;
+                    for (int k = 0; k < dimension; k++)
+                    {
+                        a[i][k] += G * bodies[j].mass * dCoord[k] * invDist3;
+                    }
                 }
             }
         }
+
+        for (int i = 0; i < numOfBodies; i++)
+        {
+            for (int j = 0; j < dimension; j++)
+            {
+                bodies[i].veloc[j] += a[i][j] * deltaTime;
+            }
+        }
+    }
+
+    if (collisions && !merging)
+    {
+        collisionSolver.resolve(bodies, radius, restitutionCoeff, numOfBodies);
     }
 
     for (int i = 0; i < numOfBodies; i++)
     {
         for (int j = 0; j < dimension; j++)
         {
-            bodies[i].veloc[j] += a[i][j] * deltaTime;
+            if (!regularized)
+            {
+                bodies[i].coord[j] += bodies[i].veloc[j] * deltaTime;
+            }
         }
     }
 
-    if (collisions)
+    if (collisions && merging)
     {
-        for (int i = 0; i < numOfBodies; i++)
-        {
-            for (int k = i + 1; k < numOfBodies; k++)
-            {
-                std::vector<float> n(dimension, 0.0f);
-                float distSqr = 0.0f;
-                for (int l = 0; l < dimension; l++)
-                {
-                    n[l] = bodies[i].coord[l] - bodies[k].coord[l];
-                    distSqr += n[l] * n[l];
-                }
-
-                float rSum = 2 * radius;
-                if (distSqr > rSum * rSum)
-                {
-                    continue;
-                }
-
-                float dist = sqrt(distSqr);
-
-                std::vector<float> nNormal(dimension);
-                for (int l = 0; l < dimension; l++)
-                {
-                    nNormal[l] = n[l] / dist;
-                }
-
-                float mi = bodies[i].mass;
-                float mk = bodies[k].mass;
+        mergeBodies();
+    }
 
-                std::vector<float> vRel(dimension);
-                for (int l = 0; l < dimension; l++)
-                {
-                    vRel[l] = bodies[i].veloc[l] - bodies[k].veloc[l];
-                }
+    uploadPositions();
+}
+void drawSimNBodyBig3D(GLFWwindow *window)
+{
+    sim::TraceScope trace("drawSimNBodyBig3D");
+    projection = glm::perspective(glm::radians(camera.getFov()), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 view = camera.lookAt();
+    shaderProgramLine.use();
+    shaderProgramLine.uniform4mat("projection", projection);
+    shaderProgramLine.uniform4mat("view", view);
+    glBindVertexArray(lineVAO);
+    glDrawArrays(GL_LINES, 0, 12);
 
-                float vRelNormal = dotProduct(dimension, vRel, nNormal);
-                if (vRelNormal > 0)
-                {
-                    continue;
-                }
+    // Only cells inside the frustum reach the GPU, and a cell is drawn as its
+    // centre of mass once it would cover fewer than lodPixels pixels.
+    profiler.begin(sim::Phase::TreeBuild);
+    octree.build(bodies, 8);
+    profiler.end(sim::Phase::TreeBuild);
+    float planes[6][4];
+    extractFrustum(projection * view * glm::scale(glm::mat4(1.0f), glm::vec3(worldScale)), planes);
+    glm::vec3 cameraPos = camera.getCameraPos() / worldScale;
+    float eye[3] = {cameraPos.x, cameraPos.y, cameraPos.z};
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    float lodRatio = lodPixels * 2.0f * tanf(glm::radians(camera.getFov()) / 2.0f) / std::max(height, 1);
+    profiler.begin(sim::Phase::StagingCopy);
+    octree.cull(planes, eye, lodRatio, visiblePoints);
+    profiler.end(sim::Phase::StagingCopy);
+
+    profiler.begin(sim::Phase::Upload);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, visiblePoints.size() * sizeof(float), visiblePoints.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    profiler.end(sim::Phase::Upload);
+    profiler.addBytesUploaded(visiblePoints.size() * sizeof(float));
+    shaderProgram.use();
+    shaderProgram.uniform1f("radius", radius);
+    shaderProgram.uniform1f("scale", worldScale);
+    shaderProgram.uniform4mat("projection", projection);
+    shaderProgram.uniform4mat("view", view);
+    glBindVertexArray(VAO);
+    glDrawArrays(GL_POINTS, 0, visiblePoints.size() / 4);
 
-                float impulse = -(1.0f + restitutionCoeff) * vRelNormal / (1.0f / mi + 1.0f / mk);
+    if (infos)
+    {
+        ImVec2 window_pos = ImVec2(0.0f, 0.0f);
+        ImGui::SetNextWindowPos(window_pos, ImGuiCond_Always);
+        ImGui::SetNextWindowBgAlpha(0.0f);
+        ImGui::Begin("Infos", nullptr,
+                     ImGuiWindowFlags_NoDecoration |
+                         ImGuiWindowFlags_NoMove |
+                         ImGuiWindowFlags_NoSavedSettings |
+                         ImGuiWindowFlags_AlwaysAutoResize |
+                         ImGuiWindowFlags_NoBackground);
+        ImGui::Text("xCamera=%.2f yCamera=%.2f zCamera=%.2f",
+                    cameraPos.x * worldScale,
+                    cameraPos.y * worldScale,
+                    cameraPos.z * worldScale);
+        ImGui::Text("Bodies=%d\nDrawn bodies=%d\nMerged cells=%d",
+                    numOfBodies, octree.getVisibleBodies(), octree.getAggregatedCells());
+        ImGui::End();
+    }
 
-                for (int l = 0; l < dimension; l++)
-                {
-                    bodies[i].veloc[l] += impulse / mi * nNormal[l];
-                    bodies[k].veloc[l] -= impulse / mk * nNormal[l];
-                }
-                float overlap = 0.5f * (rSum - dist);
-                for (int l = 0; l < dimension; l++)
+    profiler.begin(sim::Phase::ForceWalk);
+    octree.accelerations(G, alpha, openingAngle, accelerations, potentials);
+    profiler.end(sim::Phase::ForceWalk);
+    profiler.addInteractions(octree.getInteractions());
+    diagnostics.step(deltaTime, bodies, potentials);
+    profiler.begin(sim::Phase::Integration);
+    threadPool.parallelFor(numOfBodies, [&](int begin, int end)
+                           {
+        for (int i = begin; i < end; i++)
+        {
+            for (int j = 0; j < dimension; j++)
+            {
+                bodies[i].veloc[j] += accelerations[i * 3 + j] * deltaTime;
+                bodies[i].coord[j] += bodies[i].veloc[j] * deltaTime;
+            }
+        } });
+    profiler.end(sim::Phase::Integration);
+    profiler.begin(sim::Phase::Collisions);
+    if (collisions && !merging)
+    {
+        collisionSolver.resolve(bodies, radius, restitutionCoeff, numOfBodies);
+    }
+    if (collisions && merging)
+    {
+        mergeBodies();
+    }
+    profiler.end(sim::Phase::Collisions);
+}
+
+
+float vectorMagnitude(std::vector<float> &coords)
+{
+    float result = 0.0;
+    for (int i = 0; i < coords.size(); i++)
+    {
+        result += coords[i] * coords[i];
+    }
+    return result;
+}
+
+void drawEnsembleControls()
+{
+    ImGui::Text("Ensemble:");
+    if (ImGui::InputInt("Runs", &ensembleRuns, 100, 10000))
+    {
+        ensembleRuns = std::min(1000000, std::max(ensembleRuns, 1));
+    }
+    if (ImGui::InputFloat("Spread", &ensembleSpread, 1.0f, 10.0f, "%.2f"))
+    {
+        ensembleSpread = std::max(0.0f, std::min(ensembleSpread, 1000.0f));
+    }
+    if (ImGui::InputFloat("Duration", &ensembleDuration, 10.0f, 100.0f, "%.2f"))
+    {
+        ensembleDuration = std::max(1.0f, std::min(ensembleDuration, 10000.0f));
+    }
+    if (ensembleJob.valid())
+    {
+        if (ensembleJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            ensembleSummary = ensembleJob.get();
+        }
+        else
+        {
+            ImGui::Text("Running...");
+        }
+    }
+    else if (numOfBodies != 3 || bodies.size() != 3)
+    {
+        // Merging or a loaded snapshot can leave fewer than three bodies.
+        ImGui::Text("Ensembles need exactly three bodies");
+    }
+    else if (ImGui::Button("Run ensemble"))
+    {
+        std::vector<sim::EnsembleRun> initial(ensembleRuns);
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> offset(-ensembleSpread, ensembleSpread);
+        for (int r = 0; r < ensembleRuns; r++)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                initial[r].mass[i] = bodies[i].mass;
+                for (int j = 0; j < 3; j++)
                 {
-                    float correction = overlap * nNormal[l];
-                    bodies[i].coord[l] += correction * (mk / (mi + mk));
-                    bodies[k].coord[l] -= correction * (mi / (mi + mk));
+                    initial[r].coord[i][j] = j < dimension ? bodies[i].coord[j] + offset(rng) : 0.0;
+                    initial[r].veloc[i][j] = j < dimension ? bodies[i].veloc[j] : 0.0;
                 }
             }
         }
+        ensembleSummary.clear();
+        ensembleJob = std::async(std::launch::async, runEnsemble, std::move(initial), dimension, ensembleDuration);
     }
+    if (!ensembleSummary.empty())
+    {
+        ImGui::Text("%s", ensembleSummary.c_str());
+    }
+}
 
-    for (int i = 0; i < numOfBodies; i++)
+std::string runEnsemble(std::vector<sim::EnsembleRun> initial, int dimension, double duration)
+{
+    sim::ThreadPool pool;
+    sim::Ensemble ensemble(pool);
+    std::vector<sim::EnsembleResult> results;
+    double start = glfwGetTime();
+    ensemble.run(dimension, initial, results, G, alpha, ensembleStep, duration, escapeDistance, cancelJobs);
+    double elapsed = glfwGetTime() - start;
+
+    std::ofstream file("ensemble.csv");
+    file << "run,escapeTime,escaper,binaryEnergy\n";
+    int escaped = 0;
+    double escapeTimeSum = 0.0;
+    for (int r = 0; r < results.size(); r++)
+    {
+        file << r << ',' << results[r].escapeTime << ',' << results[r].escaper + 1 << ',' << results[r].binaryEnergy << '\n';
+        if (results[r].escapeTime >= 0)
+        {
+            escaped++;
+            escapeTimeSum += results[r].escapeTime;
+        }
+    }
+
+    std::stringstream summary;
+    summary << results.size() << " runs in " << elapsed << "s -> ensemble.csv\n"
+            << "Escaped: " << escaped;
+    if (escaped > 0)
     {
-        for (int j = 0; j < dimension; j++)
+        summary << ", mean escape time " << escapeTimeSum / escaped;
+    }
+    return summary.str();
+}
+
+void drawStabilityMapControls(int movable, double softening)
+{
+    ImGui::Text("Stability map (first body):");
+    if (ImGui::InputInt("Grid", &mapSize, 16, 64))
+    {
+        mapSize = std::min(1024, std::max(mapSize, 8));
+    }
+    if (ImGui::InputFloat("Range", &mapRange, 10.0f, 100.0f, "%.2f"))
+    {
+        mapRange = std::max(1.0f, std::min(mapRange, 10000.0f));
+    }
+    if (ImGui::InputFloat("Map time", &mapDuration, 1.0f, 10.0f, "%.2f"))
+    {
+        mapDuration = std::max(0.1f, std::min(mapDuration, 1000.0f));
+    }
+    if (mapJob.valid())
+    {
+        if (mapJob.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
         {
-            bodies[i].coord[j] += bodies[i].veloc[j] * deltaTime;
-            vertices[i * dimension + j] = bodies[i].coord[j] / 1000.0f;
+            mapSummary = mapJob.get();
+        }
+        else
+        {
+            ImGui::Text("Computing...");
         }
     }
+    else if (ImGui::Button("Compute map"))
+    {
+        mapSummary.clear();
+        mapJob = std::async(std::launch::async, runStabilityMap, bodies, movable, softening, mapSize, mapRange, mapDuration);
+    }
+    if (!mapSummary.empty())
+    {
+        ImGui::Text("%s", mapSummary.c_str());
+    }
+}
 
+std::string runStabilityMap(std::vector<sim::Body> initial, int movable, double softening, int size, float range, double duration)
+{
+    sim::ThreadPool pool;
+    sim::StabilityMap map(pool);
+    double start = glfwGetTime();
+    map.compute(initial, movable, 0, -range, range, -range, range, size, size,
+                G, softening, mapStep, duration, cancelJobs);
+    double elapsed = glfwGetTime() - start;
+    if (!map.writeImage("stability_map.ppm") || !map.writeRaw("stability_map.bin"))
+    {
+        return "Failed to write stability map";
+    }
+    std::stringstream summary;
+    summary << size << "x" << size << " map in " << elapsed << "s\n-> stability_map.ppm, stability_map.bin";
+    return summary.str();
+}
+
+void mergeBodies()
+{
+    int before = numOfBodies;
+    numOfBodies = collisionSolver.merge(bodies, radius, bodyIds);
+    if (numOfBodies == before)
+    {
+        return;
+    }
+    if (option == sim::Option::NBodyBig3D)
+    {
+        // This mode refills its point buffer from the octree every frame.
+        return;
+    }
+
+    const std::vector<int> &survivors = collisionSolver.getSurvivors();
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(float), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBufferData(GL_ARRAY_BUFFER, positionBytes(numOfBodies), NULL, GL_DYNAMIC_DRAW);
+    uploadPositions();
+    savePreviousPositions();
+
+    if (densityView)
+    {
+        uploadMasses();
+    }
+    if (trail && option == sim::Option::NBodyBig)
+    {
+        initGpuTrail();
+    }
+    else if (trail)
+    {
+        for (int j = 0; j < trailLength; j++)
+        {
+            for (int i = 0; i < numOfBodies; i++)
+            {
+                trailVertices[j * numOfBodies + i] = trailVertices[j * before + survivors[i]];
+            }
+        }
+        trailVertices.resize(numOfBodies * trailLength);
+        glBindBuffer(GL_ARRAY_BUFFER, trailVBO);
+        glBufferData(GL_ARRAY_BUFFER, trailVertices.size() * sizeof(trailStruct), trailVertices.data(), GL_DYNAMIC_DRAW);
+    }
+}
+
+void uploadPositions()
+{
+    // Positions go from the bodies straight into the orphaned VBO in world
+    // units, or as 16-bit fractions of the view bounds when compactPositions
+    // is set; the vertex shaders apply the matching scale and offset.
+    profiler.begin(sim::Phase::Upload);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    void *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, positionBytes(numOfBodies), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    profiler.end(sim::Phase::Upload);
     if (ptr != NULL)
     {
-        memcpy(ptr, vertices.data(), vertices.size() * sizeof(float));
+        profiler.begin(sim::Phase::StagingCopy);
+        threadPool.parallelFor(numOfBodies, [&](int begin, int end)
+                               {
+            for (int i = begin; i < end; i++)
+            {
+                for (int j = 0; j < dimension; j++)
+                {
+                    if (compactPositions)
+                    {
+                        ((uint16_t *)ptr)[i * dimension + j] = quantizePosition(bodies[i].coord[j]);
+                    }
+                    else
+                    {
+                        ((float *)ptr)[i * dimension + j] = bodies[i].coord[j];
+                    }
+                }
+            } });
+        profiler.end(sim::Phase::StagingCopy);
+        profiler.begin(sim::Phase::Upload);
         glUnmapBuffer(GL_ARRAY_BUFFER);
+        profiler.end(sim::Phase::Upload);
+        profiler.addBytesUploaded(positionBytes(numOfBodies));
     }
 }
 
-float vectorMagnitude(std::vector<float> &coords)
+void savePreviousPositions()
 {
-    float result = 0.0;
-    for (int i = 0; i < coords.size(); i++)
+    if (prevVBO == 0)
     {
-        result += coords[i] * coords[i];
+        return;
     }
-    return result;
+    glBindBuffer(GL_COPY_READ_BUFFER, VBO);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, prevVBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, positionBytes(numOfBodies), NULL, GL_STREAM_DRAW);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, positionBytes(numOfBodies));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 }
 
-float dotProduct(int dimension, std::vector<float> &coords1, std::vector<float> &coords2)
+void uploadMasses()
 {
-    float result = 0.0f;
-    for (int i = 0; i < dimension; i++)
+    // Density splats weight each body by its mass, read from attribute 1.
+    std::vector<float> masses(numOfBodies);
+    for (int i = 0; i < numOfBodies; i++)
     {
-        result += coords1[i] * coords2[i];
+        masses[i] = bodies[i].mass;
+    }
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, massVBO);
+    glBufferData(GL_ARRAY_BUFFER, masses.size() * sizeof(float), masses.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void *)0);
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+size_t positionBytes(int count)
+{
+    return (size_t)count * dimension * (compactPositions ? sizeof(uint16_t) : sizeof(float));
+}
+
+uint16_t quantizePosition(float x)
+{
+    float t = (x + viewBounds) / (2.0f * viewBounds);
+    return (uint16_t)(std::max(0.0f, std::min(t, 1.0f)) * 65535.0f + 0.5f);
+}
+
+void setPositionUniforms(gui::Shader &shader)
+{
+    if (compactPositions)
+    {
+        shader.uniform1f("scale", 2.0f * viewBounds * worldScale);
+        shader.uniform2f("offset", -viewBounds * worldScale, -viewBounds * worldScale);
+    }
+    else
+    {
+        shader.uniform1f("scale", worldScale);
+        shader.uniform2f("offset", 0.0f, 0.0f);
     }
-    return result;
+}
+void extractFrustum(const glm::mat4 &clip, float planes[6][4])
+{
+    // Gribb and Hartmann: each plane is the fourth row of the clip matrix plus
+    // or minus one of the others, normalised so distances are in world units.
+    for (int p = 0; p < 6; p++)
+    {
+        int row = p / 2;
+        float sign = p % 2 == 0 ? 1.0f : -1.0f;
+        for (int k = 0; k < 4; k++)
+        {
+            planes[p][k] = clip[k][3] + sign * clip[k][row];
+        }
+        float length = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+        for (int k = 0; k < 4; k++)
+        {
+            planes[p][k] /= length;
+        }
+    }
+}
+
+
+void pushTrail(int count)
+{
+    // The trail is a ring of trailLength slots, each holding one position per
+    // body, so a frame only writes and uploads the slot at trailHead.
+    for (int i = 0; i < count; i++)
+    {
+        trailVertices[trailHead * count + i].x = bodies[i].coord[0];
+        trailVertices[trailHead * count + i].y = bodies[i].coord[1];
+    }
+    sim::ProfileScope scope(profiler, sim::Phase::Upload);
+    glBindBuffer(GL_ARRAY_BUFFER, trailVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, trailHead * count * sizeof(trailStruct), count * sizeof(trailStruct),
+                    &trailVertices[trailHead * count]);
+    profiler.addBytesUploaded(count * sizeof(trailStruct));
+    trailHead = (trailHead + 1) % trailLength;
+}
+
+void initGpuTrail()
+{
+    // The large-n trail lives only on the GPU: a texture buffer holding
+    // gpuTrailLength slots of numOfBodies positions, read by gl_InstanceID
+    // (slot) and gl_VertexID (body) in bigNBodiesTrail.ver.
+    int maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    gpuTrailLength = std::max(1, std::min((int)trailLength, maxTexels / std::max(numOfBodies, 1)));
+    trailHead = 0;
+
+    // Every slot starts at the current positions, which VBO already holds.
+    // Slot 0 is copied from VBO and the filled prefix is then doubled, so
+    // seeding takes log2(gpuTrailLength) copies and no host memory.
+    size_t slotBytes = positionBytes(numOfBodies);
+    glBindBuffer(GL_TEXTURE_BUFFER, trailVBO);
+    glBufferData(GL_TEXTURE_BUFFER, slotBytes * gpuTrailLength, NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_COPY_READ_BUFFER, VBO);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, trailVBO);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, slotBytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, trailVBO);
+    for (int filled = 1; filled < (int)gpuTrailLength; filled *= 2)
+    {
+        int count = std::min(filled, (int)gpuTrailLength - filled);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, filled * slotBytes, count * slotBytes);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, trailTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, compactPositions ? GL_RG16 : GL_RG32F, trailVBO);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
 }
 
 GLFWimage loadIcon(const char *filename)
@@ -1809,3 +2979,231 @@ GLFWimage loadIcon(const char *filename)
 
     return icon;
 }
+
+void saveSnapshot()
+{
+    sim::SnapshotInfo info = {(int)option, dimension, radius, restitutionCoeff, trail, walls, collisions, merging};
+    if (sim::saveSnapshot(snapshotPath, info, bodies, bodyIds))
+    {
+        std::cout << "Saved " << bodies.size() << " bodies to " << snapshotPath << std::endl;
+    }
+    else
+    {
+        std::cerr << "Failed to save snapshot to " << snapshotPath << std::endl;
+    }
+}
+
+void saveTrace()
+{
+    std::string error;
+    if (sim::dumpTrace(tracePath, error))
+    {
+        std::cout << "Saved trace to " << tracePath << std::endl;
+    }
+    else
+    {
+        std::cerr << "Failed to save trace: " << error << std::endl;
+    }
+}
+
+bool loadSnapshot()
+{
+    sim::SnapshotInfo info;
+    std::vector<sim::Body> loaded;
+    std::vector<int> loadedIds;
+    std::string error;
+    if (!sim::loadSnapshot(threadPool, snapshotPath, info, loaded, loadedIds, error))
+    {
+        snapshotStatus = "Snapshot: " + error;
+        std::cerr << "Failed to load snapshot: " << error << std::endl;
+        return false;
+    }
+    sim::Option loadedOption = (sim::Option)info.option;
+    int count = loaded.size();
+    bool fits;
+    switch (loadedOption)
+    {
+    case sim::Option::ThreeBody2D:
+        fits = info.dimension == 2 && count >= 1 && count <= 3;
+        break;
+    case sim::Option::TwoFixedBody:
+        fits = info.dimension == 2 && count == 3;
+        break;
+    case sim::Option::NBodySmall:
+    case sim::Option::Tracers:
+        fits = info.dimension == 2 && count >= 1 && count <= 10;
+        break;
+    case sim::Option::NBodyBig:
+        fits = info.dimension == 2 && count >= 1;
+        break;
+    case sim::Option::ThreeBody3D:
+        fits = info.dimension == 3 && count >= 1 && count <= 3;
+        break;
+    case sim::Option::NBodyBig3D:
+        fits = info.dimension == 3 && count >= 1;
+        break;
+    default:
+        fits = false;
+        break;
+    }
+    if (!fits)
+    {
+        snapshotStatus = "Snapshot: does not match its mode";
+        std::cerr << "Failed to load snapshot: does not match its mode" << std::endl;
+        return false;
+    }
+    bodies = std::move(loaded);
+    bodyIds = std::move(loadedIds);
+    option = loadedOption;
+    dimension = info.dimension;
+    numOfBodies = count;
+    radius = info.radius;
+    restitutionCoeff = info.restitution;
+    trail = info.trail;
+    walls = info.walls;
+    collisions = info.collisions;
+    merging = info.merging && option != sim::Option::TwoFixedBody;
+    state = sim::States::Init;
+    snapshotStatus.clear();
+    return true;
+}
+
+void drawProfiler()
+{
+    ImGuiIO &io = ImGui::GetIO();
+    ImGui::SetNextWindowPos(ImVec2(io.DisplaySize.x, 0.0f), ImGuiCond_Always, ImVec2(1.0f, 0.0f));
+    ImGui::SetNextWindowBgAlpha(0.6f);
+    ImGui::Begin("Profiler", nullptr,
+                 ImGuiWindowFlags_NoDecoration |
+                     ImGuiWindowFlags_NoMove |
+                     ImGuiWindowFlags_NoSavedSettings |
+                     ImGuiWindowFlags_AlwaysAutoResize);
+    ImGui::PushFont(smallFont);
+    ImGui::Text("Frame %.2f ms, %.0f steps/s", profiler.getFrameMilliseconds(), profiler.getStepsPerSecond());
+    ImGui::Text("%.3g interactions/s, %.2f MB uploaded/frame",
+                profiler.getInteractionsPerSecond(), profiler.getBytesPerFrame() / 1048576.0);
+    for (int p = 0; p < (int)sim::Phase::Count; p++)
+    {
+        sim::Phase phase = (sim::Phase)p;
+        const std::vector<float> &history = profiler.getHistory(phase);
+        ImGui::PushID(p);
+        ImGui::PlotHistogram("##history", history.data(), history.size(), profiler.getHead(),
+                             NULL, 0.0f, FLT_MAX, ImVec2(240.0f, 32.0f));
+        ImGui::PopID();
+        ImGui::SameLine();
+        ImGui::Text("%s\np50 %.2f  p95 %.2f  p99 %.2f ms", sim::Profiler::getName(phase),
+                    profiler.getPercentile(phase, 50.0f), profiler.getPercentile(phase, 95.0f),
+                    profiler.getPercentile(phase, 99.0f));
+        double cycles = profiler.getCounterTotal(phase, sim::Counter::Cycles);
+        double instructions = profiler.getCounterTotal(phase, sim::Counter::Instructions);
+        if (profiler.hasCounters() && cycles > 0.0 && instructions > 0.0)
+        {
+            ImGui::Text("IPC %.2f, per 1k instructions: %.2f cache misses, %.2f branch misses",
+                        instructions / cycles,
+                        profiler.getCounterTotal(phase, sim::Counter::CacheMisses) * 1000.0 / instructions,
+                        profiler.getCounterTotal(phase, sim::Counter::BranchMisses) * 1000.0 / instructions);
+        }
+    }
+    ImGui::PopFont();
+    ImGui::End();
+}
+
+void drawDiagnosticsControls()
+{
+    if (ImGui::InputInt("Diagnostics every (steps, 0 = off)", &diagnosticsInterval, 1, 100))
+    {
+        diagnosticsInterval = std::max(0, std::min(diagnosticsInterval, 100000));
+    }
+}
+
+void startDiagnostics()
+{
+    diagnostics.stop();
+    if (diagnosticsInterval > 0 && !diagnostics.start("diagnostics.csv", diagnosticsInterval))
+    {
+        std::cerr << "Failed to open diagnostics.csv" << std::endl;
+    }
+}
+
+void drawDiagnostics()
+{
+    const sim::DiagnosticsSample &sample = diagnostics.getLatest();
+    ImGuiIO &io = ImGui::GetIO();
+    ImGui::SetNextWindowPos(ImVec2(io.DisplaySize.x, io.DisplaySize.y), ImGuiCond_Always, ImVec2(1.0f, 1.0f));
+    ImGui::SetNextWindowBgAlpha(0.0f);
+    ImGui::Begin("Diagnostics", nullptr,
+                 ImGuiWindowFlags_NoDecoration |
+                     ImGuiWindowFlags_NoMove |
+                     ImGuiWindowFlags_NoSavedSettings |
+                     ImGuiWindowFlags_AlwaysAutoResize |
+                     ImGuiWindowFlags_NoBackground);
+    ImGui::Text("E=%.4g (drift %.2e)\nVirial ratio=%.3f\n|P|=%.3g |L|=%.3g",
+                sample.kinetic + sample.potential, diagnostics.getEnergyDrift(), sample.virialRatio,
+                sqrt(sample.momentum[0] * sample.momentum[0] + sample.momentum[1] * sample.momentum[1] +
+                     sample.momentum[2] * sample.momentum[2]),
+                sqrt(sample.angularMomentum[0] * sample.angularMomentum[0] +
+                     sample.angularMomentum[1] * sample.angularMomentum[1] +
+                     sample.angularMomentum[2] * sample.angularMomentum[2]));
+    ImGui::End();
+}
+
+bool canReplay()
+{
+    return dimension == 2 && option != sim::Option::Tracers;
+}
+
+void drawReplay()
+{
+    int count = replayBuffer.decode(replayFrame, replayVertices, 1.0f);
+    shaderProgram.use();
+    shaderProgram.uniform1f("radius", radius);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    if (option == sim::Option::NBodyBig)
+    {
+        setPositionUniforms(shaderProgram);
+        shaderProgram.uniform1f("lag", 0.0f);
+    }
+    else
+    {
+        shaderProgram.uniform1f("scale", worldScale);
+    }
+    if (compactPositions)
+    {
+        std::vector<uint16_t> quantized(replayVertices.size());
+        for (size_t k = 0; k < replayVertices.size(); k++)
+        {
+            quantized[k] = quantizePosition(replayVertices[k]);
+        }
+        glBufferData(GL_ARRAY_BUFFER, quantized.size() * sizeof(uint16_t), quantized.data(), GL_DYNAMIC_DRAW);
+    }
+    else
+    {
+        glBufferData(GL_ARRAY_BUFFER, replayVertices.size() * sizeof(float), replayVertices.data(), GL_DYNAMIC_DRAW);
+    }
+    glDrawArrays(GL_POINTS, 0, count);
+
+    ImGuiIO &io = ImGui::GetIO();
+    ImGui::SetNextWindowPos(ImVec2(0.0f, io.DisplaySize.y), ImGuiCond_Always, ImVec2(0.0f, 1.0f));
+    ImGui::SetNextWindowSize(ImVec2(io.DisplaySize.x, 0.0f), ImGuiCond_Always);
+    ImGui::SetNextWindowBgAlpha(0.0f);
+    ImGui::Begin("Replay", nullptr,
+                 ImGuiWindowFlags_NoDecoration |
+                     ImGuiWindowFlags_NoMove |
+                     ImGuiWindowFlags_NoSavedSettings |
+                     ImGuiWindowFlags_NoBackground);
+    ImGui::Text("%s %d/%d, %.1f MB, %.1fx compressed", paused ? "Paused" : "Replaying",
+                replayFrame + 1, replayBuffer.size(),
+                replayBuffer.getMemoryUsed() / 1048576.0, replayBuffer.getCompressionRatio());
+    ImGui::SetNextItemWidth(io.DisplaySize.x - 20.0f);
+    ImGui::SliderInt("##Timeline", &replayFrame, 0, replayBuffer.size() - 1);
+    ImGui::End();
+
+    if (!paused && ++replayFrame >= replayBuffer.size())
+    {
+        replayFrame = -1;
+        glBufferData(GL_ARRAY_BUFFER, positionBytes(numOfBodies), NULL, GL_DYNAMIC_DRAW);
+        uploadPositions();
+        savePreviousPositions();
+    }
+}
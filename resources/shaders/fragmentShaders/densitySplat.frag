@@ -0,0 +1,8 @@
+#version 330 core
+in float vMass;
+out vec4 FragColor;
+
+void main()
+{
+    FragColor = vec4(vMass, 0.0, 0.0, 0.0);
+}
@@ -0,0 +1,12 @@
+#version 330 core
+in vec2 vTexCoord;
+out vec4 FragColor;
+
+uniform sampler2D uDensity;
+uniform float uExposure;
+
+void main()
+{
+    float density = texture(uDensity, vTexCoord).r;
+    FragColor = vec4(0.0, 0.0, 0.0, 1.0-exp(-density*uExposure));
+}
@@ -0,0 +1,101 @@
+#include "gui/densityRenderer.hpp"
+#include <algorithm>
+
+namespace gui
+{
+    DensityRenderer::DensityRenderer()
+        : fbo(0), texture(0), emptyVAO(0), target(0), downsample(1), width(0), height(0), textureWidth(0), textureHeight(0)
+    {
+    }
+
+    void DensityRenderer::create(int downsample)
+    {
+        destroy();
+        this->downsample = std::max(downsample, 1);
+        splatShader = Shader("resources/shaders/vertexShaders/densitySplat.ver",
+                             "resources/shaders/fragmentShaders/densitySplat.frag");
+        toneMapShader = Shader("resources/shaders/vertexShaders/toneMap.ver",
+                               "resources/shaders/fragmentShaders/toneMap.frag");
+        glGenFramebuffers(1, &fbo);
+        glGenTextures(1, &texture);
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    void DensityRenderer::destroy()
+    {
+        if (fbo == 0)
+        {
+            return;
+        }
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteTextures(1, &texture);
+        glDeleteVertexArrays(1, &emptyVAO);
+        splatShader.destroy();
+        toneMapShader.destroy();
+        fbo = 0;
+        texture = 0;
+        emptyVAO = 0;
+        textureWidth = 0;
+        textureHeight = 0;
+    }
+
+    void DensityRenderer::resize(int width, int height)
+    {
+        int w = std::max(width / downsample, 1);
+        int h = std::max(height / downsample, 1);
+        if (w == textureWidth && h == textureHeight)
+        {
+            return;
+        }
+        textureWidth = w;
+        textureHeight = h;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cerr << "ERROR::FRAMEBUFFER::DENSITY_INCOMPLETE" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+    }
+
+    Shader &DensityRenderer::begin(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+        // Tone-map into whatever was bound before, which is not the window
+        // when rendering offscreen.
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &target);
+        resize(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, textureWidth, textureHeight);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        splatShader.use();
+        return splatShader;
+    }
+
+    void DensityRenderer::end(float exposure)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        glViewport(0, 0, width, height);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        toneMapShader.use();
+        toneMapShader.uniform1i("uDensity", 0);
+        toneMapShader.uniform1f("uExposure", exposure / (downsample * downsample));
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDisable(GL_BLEND);
+    }
+}
@@ -0,0 +1,237 @@
+#include "gui/frameRecorder.hpp"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace gui
+{
+    FrameRecorder::FrameRecorder()
+        : fbo(0), colorBuffer(0), depthBuffer(0), pbo{0, 0}, width(0), height(0), framesCaptured(0),
+          head(0), tail(0), running(false), framesWritten(0), framesDropped(0)
+    {
+    }
+
+    FrameRecorder::~FrameRecorder()
+    {
+        // GL objects need a current context, so only the thread is stopped here.
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running)
+            {
+                return;
+            }
+            running = false;
+        }
+        filled.notify_one();
+        thread.join();
+    }
+
+    bool FrameRecorder::create(int width, int height, const std::string &prefix, int numBuffers)
+    {
+        destroy();
+        this->width = width;
+        this->height = height;
+        this->prefix = prefix;
+        size_t frameBytes = (size_t)width * height * 4;
+
+        glGenFramebuffers(1, &fbo);
+        glGenRenderbuffers(1, &colorBuffer);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!complete)
+        {
+            std::cerr << "ERROR::FRAMEBUFFER::RECORDER_INCOMPLETE" << std::endl;
+            destroy();
+            return false;
+        }
+
+        glGenBuffers(2, pbo);
+        for (int i = 0; i < 2; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        ring.assign(std::max(numBuffers, 2), Frame());
+        for (Frame &frame : ring)
+        {
+            frame.pixels.resize(frameBytes);
+        }
+        full.assign(ring.size(), false);
+        head = 0;
+        tail = 0;
+        framesCaptured = 0;
+        framesWritten = 0;
+        framesDropped = 0;
+        running = true;
+        thread = std::thread(&FrameRecorder::writer, this);
+        return true;
+    }
+
+    void FrameRecorder::destroy()
+    {
+        if (fbo == 0)
+        {
+            return;
+        }
+        // The last readback has not been collected by capture() yet.
+        if (framesCaptured > 0 && pbo[0] != 0)
+        {
+            queue(pbo[(framesCaptured - 1) % 2], framesCaptured - 1);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        filled.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+        glDeleteBuffers(2, pbo);
+        fbo = 0;
+        colorBuffer = 0;
+        depthBuffer = 0;
+        pbo[0] = 0;
+        pbo[1] = 0;
+        ring.clear();
+    }
+
+    void FrameRecorder::bind()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, width, height);
+    }
+
+    void FrameRecorder::capture()
+    {
+        if (fbo == 0)
+        {
+            return;
+        }
+        int current = framesCaptured % 2;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[current]);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+        if (framesCaptured > 0)
+        {
+            queue(pbo[1 - current], framesCaptured - 1);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        framesCaptured++;
+    }
+
+    void FrameRecorder::queue(unsigned int buffer, unsigned long long index)
+    {
+        int slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            freed.wait(lock, [&]
+                       { return !full[head]; });
+            slot = head;
+        }
+
+        Frame &frame = ring[slot];
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        void *ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame.pixels.size(), GL_MAP_READ_BIT);
+        if (ptr == NULL)
+        {
+            framesDropped++;
+            return;
+        }
+        memcpy(frame.pixels.data(), ptr, frame.pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        frame.index = index;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            full[slot] = true;
+            head = (head + 1) % ring.size();
+        }
+        filled.notify_one();
+    }
+
+    unsigned long long FrameRecorder::getFramesCaptured() const
+    {
+        return framesCaptured;
+    }
+
+    unsigned long long FrameRecorder::getFramesWritten() const
+    {
+        return framesWritten;
+    }
+
+    unsigned long long FrameRecorder::getFramesDropped() const
+    {
+        return framesDropped;
+    }
+
+    void FrameRecorder::writer()
+    {
+        std::vector<unsigned char> row((size_t)width * 3);
+        while (true)
+        {
+            int slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                filled.wait(lock, [&]
+                            { return full[tail] || !running; });
+                if (!full[tail])
+                {
+                    return;
+                }
+                slot = tail;
+            }
+
+            // GL rows start at the bottom and carry alpha; PPM rows start at
+            // the top and are plain RGB.
+            const Frame &frame = ring[slot];
+            char name[32];
+            snprintf(name, sizeof(name), "_%05llu.ppm", frame.index);
+            FILE *file = fopen((prefix + name).c_str(), "wb");
+            if (file != nullptr)
+            {
+                fprintf(file, "P6\n%d %d\n255\n", width, height);
+                for (int y = height - 1; y >= 0; y--)
+                {
+                    const unsigned char *src = &frame.pixels[(size_t)y * width * 4];
+                    for (int x = 0; x < width; x++)
+                    {
+                        row[x * 3] = src[x * 4];
+                        row[x * 3 + 1] = src[x * 4 + 1];
+                        row[x * 3 + 2] = src[x * 4 + 2];
+                    }
+                    fwrite(row.data(), 1, row.size(), file);
+                }
+                fclose(file);
+                framesWritten++;
+            }
+            else
+            {
+                std::cerr << "Failed to open " << prefix + name << std::endl;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                full[slot] = false;
+                tail = (tail + 1) % ring.size();
+            }
+            freed.notify_one();
+        }
+    }
+}
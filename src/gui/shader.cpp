@@ -1,16 +1,95 @@
 #include "gui/shader.hpp"
+#include "simulation/replaceFile.hpp"
+#include <map>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#ifdef EMBED_SHADERS
+#include "gui/embeddedShaders.hpp"
+#endif
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
 
 namespace gui
 {
+    namespace
+    {
+        // glad is generated for core 3.3, which lacks program binaries
+        // (GL 4.1 / ARB_get_program_binary), so they are loaded by hand.
+        typedef void(APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+        typedef void(APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+        typedef void(APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+        struct
+        {
+            bool enabled = false;
+            std::string directory;
+            uint64_t driverHash = 0;
+            GetProgramBinaryProc getProgramBinary = NULL;
+            ProgramBinaryProc programBinary = NULL;
+            ProgramParameteriProc programParameteri = NULL;
+        } binaryCache;
+
+        const char binaryMagic[8] = {'N', 'B', 'S', 'H', 'B', 'I', 'N', '1'};
+
+        struct BinaryHeader
+        {
+            char magic[8];
+            uint64_t sourceHash;
+            uint64_t driverHash;
+            uint32_t format;
+            uint32_t length;
+        };
+
+        std::map<std::pair<std::string, std::string>, unsigned int> programs;
+
+        uint64_t hashString(const std::string &text, uint64_t hash = 14695981039346656037ULL)
+        {
+            // FNV-1a
+            for (unsigned char c : text)
+            {
+                hash = (hash ^ c) * 1099511628211ULL;
+            }
+            return hash;
+        }
+    }
+
     Shader::Shader()
     {
         shaderProgram = 0;
     }
     Shader::Shader(std::string vertexPath, std::string fragmentPath)
+    {
+        std::pair<std::string, std::string> key(vertexPath, fragmentPath);
+        auto cached = programs.find(key);
+        if (cached != programs.end())
+        {
+            shaderProgram = cached->second;
+            return;
+        }
+        std::string vertexSource = readFile(vertexPath);
+        std::string fragmentSource = readFile(fragmentPath);
+        shaderProgram = loadBinary(vertexSource, fragmentSource);
+        if (shaderProgram == 0)
+        {
+            shaderProgram = compile(vertexSource, fragmentSource);
+        }
+        programs[key] = shaderProgram;
+    }
+
+    unsigned int Shader::compile(const std::string &vertexSource, const std::string &fragmentSource)
     {
         unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        std::string vertexShaderSourceStr = readFile(vertexPath);
-        const char *vertexShaderSource = vertexShaderSourceStr.c_str();
+        const char *vertexShaderSource = vertexSource.c_str();
         glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
         glCompileShader(vertexShader);
         int success;
@@ -23,8 +102,7 @@ namespace gui
                       << infoLog << std::endl;
         }
         unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        std::string fragmentShaderSourceStr = readFile(fragmentPath);
-        char const *fragmentShaderSource = fragmentShaderSourceStr.c_str();
+        char const *fragmentShaderSource = fragmentSource.c_str();
         glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
         glCompileShader(fragmentShader);
         glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
@@ -34,23 +112,159 @@ namespace gui
             std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
                       << infoLog << std::endl;
         }
-        shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vertexShader);
-        glAttachShader(shaderProgram, fragmentShader);
-        glLinkProgram(shaderProgram);
-        glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+        unsigned int program = glCreateProgram();
+        if (binaryCache.enabled)
+        {
+            binaryCache.programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glAttachShader(program, vertexShader);
+        glAttachShader(program, fragmentShader);
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
         if (!success)
         {
-            glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+            glGetProgramInfoLog(program, 512, NULL, infoLog);
             std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
                       << infoLog << std::endl;
         }
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
+        if (success)
+        {
+            saveBinary(program, vertexSource, fragmentSource);
+        }
+        return program;
+    }
+
+    void Shader::enableBinaryCache(const std::string &directory, GLADloadproc load)
+    {
+        binaryCache.getProgramBinary = (GetProgramBinaryProc)load("glGetProgramBinary");
+        binaryCache.programBinary = (ProgramBinaryProc)load("glProgramBinary");
+        binaryCache.programParameteri = (ProgramParameteriProc)load("glProgramParameteri");
+        int formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        while (glGetError() != GL_NO_ERROR)
+        {
+        }
+        if (binaryCache.getProgramBinary == NULL || binaryCache.programBinary == NULL ||
+            binaryCache.programParameteri == NULL || formats == 0)
+        {
+            std::cout << "Program binaries are not supported, shaders will not be cached on disk" << std::endl;
+            return;
+        }
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        binaryCache.directory = directory;
+        std::string driver;
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+        {
+            const GLubyte *value = glGetString(name);
+            driver += value != NULL ? (const char *)value : "";
+            driver += '\n';
+        }
+        binaryCache.driverHash = hashString(driver);
+        binaryCache.enabled = true;
+    }
+
+    void Shader::clearCache()
+    {
+        for (auto &entry : programs)
+        {
+            glDeleteProgram(entry.second);
+        }
+        programs.clear();
+    }
+
+    unsigned int Shader::loadBinary(const std::string &vertexSource, const std::string &fragmentSource)
+    {
+        if (!binaryCache.enabled)
+        {
+            return 0;
+        }
+        uint64_t sourceHash = hashString(vertexSource, hashString(fragmentSource));
+        std::ifstream file(binaryPath(sourceHash), std::ios::binary);
+        BinaryHeader header;
+        if (!file.read((char *)&header, sizeof(header)) ||
+            memcmp(header.magic, binaryMagic, sizeof(binaryMagic)) != 0 ||
+            header.sourceHash != sourceHash || header.driverHash != binaryCache.driverHash)
+        {
+            return 0;
+        }
+        std::vector<char> binary(header.length);
+        if (!file.read(binary.data(), binary.size()))
+        {
+            return 0;
+        }
+        unsigned int program = glCreateProgram();
+        binaryCache.programBinary(program, header.format, binary.data(), binary.size());
+        int success = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            // The driver may reject binaries it wrote itself, e.g. after an
+            // update that kept the version string; compile from source instead.
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
+    }
+
+    void Shader::saveBinary(unsigned int program, const std::string &vertexSource, const std::string &fragmentSource)
+    {
+        if (!binaryCache.enabled)
+        {
+            return;
+        }
+        int length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+        {
+            return;
+        }
+        BinaryHeader header;
+        memcpy(header.magic, binaryMagic, sizeof(binaryMagic));
+        header.sourceHash = hashString(vertexSource, hashString(fragmentSource));
+        header.driverHash = binaryCache.driverHash;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        binaryCache.getProgramBinary(program, length, &length, &format, binary.data());
+        header.format = format;
+        header.length = length;
+
+        std::string path = binaryPath(header.sourceHash);
+        std::string tmpPath = path + ".tmp";
+        bool ok;
+        {
+            std::ofstream file(tmpPath, std::ios::binary);
+            file.write((const char *)&header, sizeof(header));
+            file.write(binary.data(), length);
+            file.close();
+            ok = (bool)file;
+        }
+        if (!ok || !sim::replaceFile(tmpPath, path))
+        {
+            std::remove(tmpPath.c_str());
+        }
+    }
+
+    std::string Shader::binaryPath(uint64_t sourceHash)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)(sourceHash ^ binaryCache.driverHash));
+        return binaryCache.directory + "/" + name;
     }
 
     std::string Shader::readFile(std::string path)
     {
+#ifdef EMBED_SHADERS
+        for (const EmbeddedShader &shader : embeddedShaders)
+        {
+            if (path == shader.path)
+            {
+                return shader.source;
+            }
+        }
+#endif
         std::ifstream file;
         file.open(path);
         std::stringstream ret;
@@ -60,7 +274,9 @@ namespace gui
     }
     void Shader::destroy()
     {
-        glDeleteProgram(shaderProgram);
+        // The program stays in the cache for the next Start; clearCache()
+        // deletes it.
+        shaderProgram = 0;
     }
     void Shader::use()
     {
@@ -75,6 +291,15 @@ namespace gui
         }
         glUniform1f(indexLoc, value);
     }
+    void Shader::uniform2f(const char *name, const float x, const float y)
+    {
+        int indexLoc = glGetUniformLocation(shaderProgram, name);
+        if (indexLoc == -1)
+        {
+            std::cerr << "WARNING::UNIFORM2F" << name << '\n';
+        }
+        glUniform2f(indexLoc, x, y);
+    }
 
     void Shader::uniform1i(const char *name, const int value)
     {
@@ -0,0 +1,255 @@
+#include "simulation/collisionSolver.hpp"
+
+namespace sim
+{
+    CollisionSolver::CollisionSolver(ThreadPool &pool) : pool(pool)
+    {
+    }
+
+    const std::vector<Contact> &CollisionSolver::getContacts() const
+    {
+        return contacts;
+    }
+
+    const std::vector<int> &CollisionSolver::getSurvivors() const
+    {
+        return survivors;
+    }
+
+    int CollisionSolver::getNumBatches() const
+    {
+        return batchStart.empty() ? 0 : batchStart.size() - 1;
+    }
+
+    void CollisionSolver::resolve(std::vector<Body> &bodies, float radius, float restitution, int movable)
+    {
+        hash.build(bodies, 2 * radius);
+        findContacts(bodies, radius);
+        colourContacts(bodies.size(), movable);
+
+        for (int b = 0; b + 1 < batchStart.size(); b++)
+        {
+            int first = batchStart[b];
+            int size = batchStart[b + 1] - first;
+            auto task = [&](int begin, int end)
+            {
+                for (int c = first + begin; c < first + end; c++)
+                {
+                    int i = batched[c].i;
+                    int k = batched[c].k;
+                    resolveContact(bodies[i], bodies[k], k >= movable, radius, restitution);
+                }
+            };
+            if (size < parallelThreshold || b == maxColours)
+            {
+                task(0, size);
+            }
+            else
+            {
+                pool.parallelFor(size, task);
+            }
+        }
+    }
+
+    int CollisionSolver::merge(std::vector<Body> &bodies, float radius, std::vector<int> &ids)
+    {
+        int n = bodies.size();
+        hash.build(bodies, 2 * radius);
+        findContacts(bodies, radius);
+
+        parent.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            parent[i] = i;
+        }
+        for (int c = 0; c < contacts.size(); c++)
+        {
+            int ri = findRoot(contacts[c].i);
+            int rk = findRoot(contacts[c].k);
+            if (ri != rk)
+            {
+                parent[std::max(ri, rk)] = std::min(ri, rk);
+            }
+        }
+
+        // Roots are the lowest index of their group, so each root is final by
+        // the time its members are folded into it.
+        for (int i = 0; i < n; i++)
+        {
+            int r = findRoot(i);
+            if (r == i)
+            {
+                continue;
+            }
+            Body &root = bodies[r];
+            float mass = root.mass + bodies[i].mass;
+            for (int l = 0; l < root.dimension; l++)
+            {
+                root.coord[l] = (root.coord[l] * root.mass + bodies[i].coord[l] * bodies[i].mass) / mass;
+                root.veloc[l] = (root.veloc[l] * root.mass + bodies[i].veloc[l] * bodies[i].mass) / mass;
+            }
+            root.mass = mass;
+        }
+
+        survivors.clear();
+        int count = 0;
+        for (int i = 0; i < n; i++)
+        {
+            if (parent[i] != i)
+            {
+                continue;
+            }
+            if (count != i)
+            {
+                std::swap(bodies[count], bodies[i]);
+                ids[count] = ids[i];
+            }
+            survivors.push_back(i);
+            count++;
+        }
+        bodies.erase(bodies.begin() + count, bodies.end());
+        ids.resize(count);
+        return count;
+    }
+
+    int CollisionSolver::findRoot(int i)
+    {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    void CollisionSolver::findContacts(const std::vector<Body> &bodies, float radius)
+    {
+        int n = bodies.size();
+        int numChunks = n < parallelThreshold ? 1 : pool.size();
+        chunkContacts.resize(numChunks);
+        int chunk = (n + numChunks - 1) / numChunks;
+        pool.parallelFor(numChunks, [&](int begin, int end)
+                         {
+            for (int c = begin; c < end; c++)
+            {
+                hash.findContacts(bodies, radius, std::min(n, c * chunk), std::min(n, (c + 1) * chunk), chunkContacts[c]);
+            } });
+
+        contacts.clear();
+        for (int c = 0; c < numChunks; c++)
+        {
+            contacts.insert(contacts.end(), chunkContacts[c].begin(), chunkContacts[c].end());
+        }
+    }
+
+    void CollisionSolver::colourContacts(int numBodies, int movable)
+    {
+        // Greedy edge colouring in contact order. Fixed bodies are never written,
+        // so they do not constrain the colour. Contacts that find no free colour
+        // go to a trailing batch that is resolved serially.
+        usedColours.assign(numBodies, 0);
+        colour.resize(contacts.size());
+        std::vector<int> counts(maxColours + 2, 0);
+        for (int c = 0; c < contacts.size(); c++)
+        {
+            int i = contacts[c].i;
+            int k = contacts[c].k;
+            if (i >= movable)
+            {
+                colour[c] = -1;
+                continue;
+            }
+            uint64_t used = usedColours[i] | (k < movable ? usedColours[k] : 0);
+            int col = maxColours;
+            if (~used != 0)
+            {
+                col = 0;
+                while (used & (1ULL << col))
+                {
+                    col++;
+                }
+                usedColours[i] |= 1ULL << col;
+                if (k < movable)
+                {
+                    usedColours[k] |= 1ULL << col;
+                }
+            }
+            colour[c] = col;
+            counts[col + 1]++;
+        }
+
+        int numColours = maxColours + 1;
+        while (numColours > 0 && counts[numColours] == 0)
+        {
+            numColours--;
+        }
+        batchStart.assign(numColours + 1, 0);
+        for (int col = 0; col < numColours; col++)
+        {
+            batchStart[col + 1] = batchStart[col] + counts[col + 1];
+        }
+        std::vector<int> cursor(batchStart.begin(), batchStart.end() - 1);
+        batched.resize(batchStart[numColours]);
+        for (int c = 0; c < contacts.size(); c++)
+        {
+            if (colour[c] >= 0)
+            {
+                batched[cursor[colour[c]]++] = contacts[c];
+            }
+        }
+    }
+
+    void CollisionSolver::resolveContact(Body &a, Body &b, bool bFixed, float radius, float restitution)
+    {
+        float n[3] = {0.0f, 0.0f, 0.0f};
+        float distSqr = 0.0f;
+        for (int l = 0; l < a.dimension; l++)
+        {
+            n[l] = a.coord[l] - b.coord[l];
+            distSqr += n[l] * n[l];
+        }
+
+        float rSum = 2 * radius;
+        if (distSqr > rSum * rSum || distSqr == 0.0f)
+        {
+            return;
+        }
+
+        float dist = sqrt(distSqr);
+        float vRelNormal = 0.0f;
+        for (int l = 0; l < a.dimension; l++)
+        {
+            n[l] /= dist;
+            vRelNormal += (a.veloc[l] - b.veloc[l]) * n[l];
+        }
+        if (vRelNormal > 0)
+        {
+            return;
+        }
+
+        float mi = a.mass;
+        float mk = b.mass;
+        if (bFixed)
+        {
+            float impulse = -(1.0f + restitution) * vRelNormal * mi;
+            float overlap = rSum - dist;
+            for (int l = 0; l < a.dimension; l++)
+            {
+                a.veloc[l] += impulse / mi * n[l];
+                a.coord[l] += overlap * n[l];
+            }
+            return;
+        }
+
+        float impulse = -(1.0f + restitution) * vRelNormal / (1.0f / mi + 1.0f / mk);
+        float overlap = 0.5f * (rSum - dist);
+        for (int l = 0; l < a.dimension; l++)
+        {
+            a.veloc[l] += impulse / mi * n[l];
+            b.veloc[l] -= impulse / mk * n[l];
+            float correction = overlap * n[l];
+            a.coord[l] += correction * (mk / (mi + mk));
+            b.coord[l] -= correction * (mi / (mi + mk));
+        }
+    }
+}
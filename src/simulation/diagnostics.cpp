@@ -0,0 +1,134 @@
+#include "simulation/diagnostics.hpp"
+#include <cmath>
+#include <algorithm>
+
+namespace sim
+{
+    Diagnostics::Diagnostics(ThreadPool &pool)
+        : pool(pool), file(nullptr), interval(1), steps(0), time(0.0), sampled(false), initialEnergy(0.0)
+    {
+    }
+
+    Diagnostics::~Diagnostics()
+    {
+        stop();
+    }
+
+    bool Diagnostics::start(const std::string &path, int interval)
+    {
+        stop();
+        file = fopen(path.c_str(), "w");
+        if (file == nullptr)
+        {
+            return false;
+        }
+        fprintf(file, "step,time,kinetic,potential,total,px,py,pz,lx,ly,lz,virial_ratio,energy_drift\n");
+        this->interval = std::max(interval, 1);
+        steps = 0;
+        time = 0.0;
+        sampled = false;
+        return true;
+    }
+
+    void Diagnostics::step(double dt, const std::vector<Body> &bodies, const std::vector<float> &potentials)
+    {
+        if (file == nullptr)
+        {
+            return;
+        }
+        if (steps % interval == 0)
+        {
+            sample(bodies, potentials);
+        }
+        steps++;
+        time += dt;
+    }
+
+    void Diagnostics::sample(const std::vector<Body> &bodies, const std::vector<float> &potentials)
+    {
+        DiagnosticsSample total = {steps, time, 0.0, 0.0, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, 0.0};
+        int n = std::min(bodies.size(), potentials.size());
+        pool.parallelFor(n, [&](int begin, int end)
+                         {
+            double kinetic = 0.0, potential = 0.0;
+            double momentum[3] = {0.0, 0.0, 0.0}, angular[3] = {0.0, 0.0, 0.0};
+            for (int i = begin; i < end; i++)
+            {
+                const Body &body = bodies[i];
+                double r[3] = {0.0, 0.0, 0.0}, p[3] = {0.0, 0.0, 0.0};
+                double v2 = 0.0;
+                for (int d = 0; d < body.dimension; d++)
+                {
+                    r[d] = body.coord[d];
+                    p[d] = body.mass * body.veloc[d];
+                    v2 += (double)body.veloc[d] * body.veloc[d];
+                }
+                kinetic += 0.5 * body.mass * v2;
+                // Every pair appears in the potentials of both of its bodies.
+                potential += 0.5 * body.mass * potentials[i];
+                for (int d = 0; d < 3; d++)
+                {
+                    momentum[d] += p[d];
+                }
+                angular[0] += r[1] * p[2] - r[2] * p[1];
+                angular[1] += r[2] * p[0] - r[0] * p[2];
+                angular[2] += r[0] * p[1] - r[1] * p[0];
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            total.kinetic += kinetic;
+            total.potential += potential;
+            for (int d = 0; d < 3; d++)
+            {
+                total.momentum[d] += momentum[d];
+                total.angularMomentum[d] += angular[d];
+            } });
+        total.virialRatio = total.potential != 0.0 ? 2.0 * total.kinetic / std::fabs(total.potential) : 0.0;
+
+        double energy = total.kinetic + total.potential;
+        if (!sampled)
+        {
+            initialEnergy = energy;
+            sampled = true;
+        }
+        latest = total;
+        fprintf(file, "%llu,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n",
+                total.step, total.time, total.kinetic, total.potential, energy,
+                total.momentum[0], total.momentum[1], total.momentum[2],
+                total.angularMomentum[0], total.angularMomentum[1], total.angularMomentum[2],
+                total.virialRatio, getEnergyDrift());
+        fflush(file);
+    }
+
+    void Diagnostics::stop()
+    {
+        if (file != nullptr)
+        {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool Diagnostics::isRunning() const
+    {
+        return file != nullptr;
+    }
+
+    bool Diagnostics::hasSample() const
+    {
+        return sampled;
+    }
+
+    const DiagnosticsSample &Diagnostics::getLatest() const
+    {
+        return latest;
+    }
+
+    double Diagnostics::getEnergyDrift() const
+    {
+        if (!sampled || initialEnergy == 0.0)
+        {
+            return 0.0;
+        }
+        return (latest.kinetic + latest.potential - initialEnergy) / std::fabs(initialEnergy);
+    }
+}
@@ -0,0 +1,202 @@
+#include "simulation/ensemble.hpp"
+
+namespace sim
+{
+    Ensemble::Ensemble(ThreadPool &pool) : pool(pool), dimension(2)
+    {
+    }
+
+    void Ensemble::run(int dimension, const std::vector<EnsembleRun> &initial, std::vector<EnsembleResult> &results,
+                       double G, double alpha, double deltaTime, double maxTime, double escapeDistance,
+                       const std::atomic<bool> &cancel)
+    {
+        this->dimension = dimension;
+        this->G = G;
+        this->alphaSqr = alpha * alpha;
+        this->deltaTime = deltaTime;
+        this->maxTime = maxTime;
+        this->escapeDistance = escapeDistance;
+
+        int n = initial.size();
+        results.assign(n, {-1.0, -1, 0.0});
+        int numBatches = (n + lanes - 1) / lanes;
+        pool.parallelFor(numBatches, [&](int begin, int end)
+                         {
+            Batch batch;
+            for (int b = begin; b < end && !cancel; b++)
+            {
+                int first = b * lanes;
+                int count = std::min(lanes, n - first);
+                // Idle lanes of the last batch repeat its first run and are
+                // never reported.
+                for (int l = 0; l < lanes; l++)
+                {
+                    const EnsembleRun &run = initial[first + (l < count ? l : 0)];
+                    for (int i = 0; i < 3; i++)
+                    {
+                        batch.mass[i][l] = run.mass[i];
+                        for (int j = 0; j < 3; j++)
+                        {
+                            batch.coord[i][j][l] = run.coord[i][j];
+                            batch.veloc[i][j][l] = run.veloc[i][j];
+                        }
+                    }
+                }
+                runBatch(batch, &results[first], count);
+            } });
+    }
+
+    void Ensemble::runBatch(Batch &batch, EnsembleResult *results, int count)
+    {
+        const int checkInterval = 16;
+        bool finished[lanes];
+        int remaining = count;
+        for (int l = 0; l < lanes; l++)
+        {
+            finished[l] = l >= count;
+        }
+
+        acceleration(batch);
+        int steps = maxTime / deltaTime;
+        for (int s = 1; s <= steps && remaining > 0; s++)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                for (int j = 0; j < dimension; j++)
+                {
+                    for (int l = 0; l < lanes; l++)
+                    {
+                        batch.veloc[i][j][l] += 0.5 * deltaTime * batch.accel[i][j][l];
+                        batch.coord[i][j][l] += deltaTime * batch.veloc[i][j][l];
+                    }
+                }
+            }
+            acceleration(batch);
+            for (int i = 0; i < 3; i++)
+            {
+                for (int j = 0; j < dimension; j++)
+                {
+                    for (int l = 0; l < lanes; l++)
+                    {
+                        batch.veloc[i][j][l] += 0.5 * deltaTime * batch.accel[i][j][l];
+                    }
+                }
+            }
+
+            if (s % checkInterval != 0)
+            {
+                continue;
+            }
+            for (int l = 0; l < count; l++)
+            {
+                if (finished[l])
+                {
+                    continue;
+                }
+                int escaper = checkEscape(batch, l);
+                if (escaper >= 0)
+                {
+                    results[l].escapeTime = s * deltaTime;
+                    results[l].escaper = escaper;
+                    results[l].binaryEnergy = pairEnergy(batch, (escaper + 1) % 3, (escaper + 2) % 3, l);
+                    finished[l] = true;
+                    remaining--;
+                }
+            }
+        }
+
+        for (int l = 0; l < count; l++)
+        {
+            if (!finished[l])
+            {
+                results[l].binaryEnergy = std::min(pairEnergy(batch, 0, 1, l),
+                                                   std::min(pairEnergy(batch, 0, 2, l), pairEnergy(batch, 1, 2, l)));
+            }
+        }
+    }
+
+    void Ensemble::acceleration(Batch &batch)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < dimension; j++)
+            {
+                for (int l = 0; l < lanes; l++)
+                {
+                    batch.accel[i][j][l] = 0.0;
+                }
+            }
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            for (int k = i + 1; k < 3; k++)
+            {
+                double invDist3[lanes];
+                for (int l = 0; l < lanes; l++)
+                {
+                    double distSqr = alphaSqr;
+                    for (int j = 0; j < dimension; j++)
+                    {
+                        double d = batch.coord[k][j][l] - batch.coord[i][j][l];
+                        distSqr += d * d;
+                    }
+                    double invDist = 1.0 / sqrt(distSqr);
+                    invDist3[l] = G * invDist * invDist * invDist;
+                }
+                for (int j = 0; j < dimension; j++)
+                {
+                    for (int l = 0; l < lanes; l++)
+                    {
+                        double d = (batch.coord[k][j][l] - batch.coord[i][j][l]) * invDist3[l];
+                        batch.accel[i][j][l] += batch.mass[k][l] * d;
+                        batch.accel[k][j][l] -= batch.mass[i][l] * d;
+                    }
+                }
+            }
+        }
+    }
+
+    double Ensemble::pairEnergy(const Batch &batch, int i, int k, int lane) const
+    {
+        double mi = batch.mass[i][lane], mk = batch.mass[k][lane];
+        double distSqr = alphaSqr, vSqr = 0.0;
+        for (int j = 0; j < dimension; j++)
+        {
+            double d = batch.coord[k][j][lane] - batch.coord[i][j][lane];
+            double v = batch.veloc[k][j][lane] - batch.veloc[i][j][lane];
+            distSqr += d * d;
+            vSqr += v * v;
+        }
+        return 0.5 * mi * mk / (mi + mk) * vSqr - G * mi * mk / sqrt(distSqr);
+    }
+
+    int Ensemble::checkEscape(const Batch &batch, int lane) const
+    {
+        for (int e = 0; e < 3; e++)
+        {
+            int i = (e + 1) % 3, k = (e + 2) % 3;
+            double me = batch.mass[e][lane];
+            double mPair = batch.mass[i][lane] + batch.mass[k][lane];
+            double distSqr = 0.0, vSqr = 0.0;
+            for (int j = 0; j < dimension; j++)
+            {
+                double c = (batch.mass[i][lane] * batch.coord[i][j][lane] + batch.mass[k][lane] * batch.coord[k][j][lane]) / mPair;
+                double v = (batch.mass[i][lane] * batch.veloc[i][j][lane] + batch.mass[k][lane] * batch.veloc[k][j][lane]) / mPair;
+                double d = batch.coord[e][j][lane] - c;
+                double dv = batch.veloc[e][j][lane] - v;
+                distSqr += d * d;
+                vSqr += dv * dv;
+            }
+            if (distSqr < escapeDistance * escapeDistance)
+            {
+                continue;
+            }
+            double energy = 0.5 * me * mPair / (me + mPair) * vSqr - G * me * mPair / sqrt(distSqr);
+            if (energy > 0)
+            {
+                return e;
+            }
+        }
+        return -1;
+    }
+}
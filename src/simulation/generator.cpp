@@ -0,0 +1,151 @@
+#include "simulation/generator.hpp"
+#include <cmath>
+#include <algorithm>
+
+namespace sim
+{
+    namespace
+    {
+        const double pi = 3.14159265358979323846;
+        const float bodyMass = 0.05f;
+
+        uint64_t mix(uint64_t z)
+        {
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        // Stateless random stream: the k-th number of a stream is a hash of
+        // its key and k, so streams can be evaluated in any order.
+        class CounterRng
+        {
+        public:
+            CounterRng(uint64_t seed, uint64_t index) : key(mix(mix(seed) ^ (index * 0x9E3779B97F4A7C15ull))), counter(0) {}
+            double uniform()
+            {
+                return (mix(key + 0x9E3779B97F4A7C15ull * ++counter) >> 11) * (1.0 / 9007199254740992.0);
+            }
+            double normal()
+            {
+                double u = std::max(uniform(), 1e-300);
+                return std::sqrt(-2.0 * std::log(u)) * std::cos(2.0 * pi * uniform());
+            }
+
+        private:
+            uint64_t key, counter;
+        };
+
+        void isotropic(CounterRng &rng, double length, double *out)
+        {
+            double z = 2.0 * rng.uniform() - 1.0;
+            double phi = 2.0 * pi * rng.uniform();
+            double s = std::sqrt(1.0 - z * z);
+            out[0] = length * s * std::cos(phi);
+            out[1] = length * s * std::sin(phi);
+            out[2] = length * z;
+        }
+
+        // Speed of a circular orbit at radius r around enclosed mass m under
+        // the softened force law used by the simulation.
+        double circularSpeed(double G, double m, double r, double softening)
+        {
+            return std::sqrt(G * m * r * r / std::pow(r * r + softening * softening, 1.5));
+        }
+    }
+
+    Generator::Generator(ThreadPool &pool) : pool(pool)
+    {
+    }
+
+    void Generator::generate(Distribution distribution, int count, int dimension, float scale,
+                             double G, double softening, uint64_t seed, std::vector<Body> &bodies)
+    {
+        bodies.assign(count, Body(dimension));
+        double totalMass = bodyMass * count;
+        pool.parallelFor(count, [&](int begin, int end)
+                         {
+            for (int i = begin; i < end; i++)
+            {
+                CounterRng rng(seed, i);
+                double pos[3] = {0, 0, 0}, vel[3] = {0, 0, 0};
+                float mass = bodyMass;
+                switch (distribution)
+                {
+                case Distribution::Uniform:
+                    mass = std::max((float)rng.uniform(), 0.1f) * 0.1f;
+                    for (int j = 0; j < dimension; j++)
+                    {
+                        pos[j] = (rng.uniform() - 0.5) * 2.0 * scale;
+                        vel[j] = (rng.uniform() - 0.5) * 50.0;
+                    }
+                    break;
+                case Distribution::Plummer:
+                {
+                    // Aarseth, Henon & Wielen (1974): radius from the inverse
+                    // cumulative mass, speed by rejection from the isotropic
+                    // distribution function.
+                    double r;
+                    do
+                    {
+                        r = scale / std::sqrt(std::pow(std::max(rng.uniform(), 1e-12), -2.0 / 3.0) - 1.0);
+                    } while (r > 10.0 * scale);
+                    double q, y;
+                    do
+                    {
+                        q = rng.uniform();
+                        y = 0.1 * rng.uniform();
+                    } while (y > q * q * std::pow(1.0 - q * q, 3.5));
+                    double escape = std::sqrt(2.0 * G * totalMass) * std::pow(r * r + scale * scale, -0.25);
+                    isotropic(rng, r, pos);
+                    isotropic(rng, q * escape, vel);
+                    break;
+                }
+                case Distribution::Hernquist:
+                {
+                    double r;
+                    do
+                    {
+                        double s = std::sqrt(rng.uniform());
+                        r = scale * s / std::max(1.0 - s, 1e-12);
+                    } while (r > 20.0 * scale);
+                    isotropic(rng, r, pos);
+                    double radial = std::sqrt(pos[0] * pos[0] + pos[1] * pos[1]);
+                    double enclosed = totalMass * r * r / ((r + scale) * (r + scale));
+                    double v = circularSpeed(G, enclosed, radial, softening);
+                    if (radial > 0.0)
+                    {
+                        vel[0] = -v * pos[1] / radial;
+                        vel[1] = v * pos[0] / radial;
+                    }
+                    break;
+                }
+                case Distribution::ExponentialDisk:
+                {
+                    // Surface density exp(-R/scale): R follows a Gamma(2)
+                    // distribution. Orbits are circular with a 10% dispersion.
+                    double r;
+                    do
+                    {
+                        r = -scale * std::log(std::max(rng.uniform() * rng.uniform(), 1e-300));
+                    } while (r > 10.0 * scale);
+                    double phi = 2.0 * pi * rng.uniform();
+                    pos[0] = r * std::cos(phi);
+                    pos[1] = r * std::sin(phi);
+                    double x = r / scale;
+                    double enclosed = totalMass * (1.0 - (1.0 + x) * std::exp(-x));
+                    double v = circularSpeed(G, enclosed, r, softening);
+                    vel[0] = -v * std::sin(phi) + 0.1 * v * rng.normal();
+                    vel[1] = v * std::cos(phi) + 0.1 * v * rng.normal();
+                    break;
+                }
+                }
+                bodies[i].mass = mass;
+                for (int j = 0; j < dimension; j++)
+                {
+                    bodies[i].coord[j] = pos[j];
+                    bodies[i].veloc[j] = vel[j];
+                }
+            } });
+    }
+}
@@ -0,0 +1,141 @@
+#include "simulation/hardwareCounters.hpp"
+#include <cstring>
+#include <cstdlib>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cerrno>
+#endif
+
+namespace sim
+{
+#ifdef __linux__
+    namespace
+    {
+        int openEvent(uint64_t config, pid_t tid, int group)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = config;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return syscall(SYS_perf_event_open, &attr, tid, -1, group, 0);
+        }
+    }
+#endif
+
+    HardwareCounters::HardwareCounters()
+    {
+    }
+
+    HardwareCounters::~HardwareCounters()
+    {
+        close();
+    }
+
+    bool HardwareCounters::open(std::string &error)
+    {
+        close();
+#ifdef __linux__
+        static const uint64_t configs[(int)Counter::Count] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                             PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        DIR *tasks = opendir("/proc/self/task");
+        if (tasks == nullptr)
+        {
+            error = "cannot list /proc/self/task";
+            return false;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(tasks)) != nullptr)
+        {
+            if (entry->d_name[0] == '.')
+            {
+                continue;
+            }
+            pid_t tid = atoi(entry->d_name);
+            int leader = openEvent(configs[0], tid, -1);
+            if (leader < 0)
+            {
+                error = std::string("perf_event_open: ") + strerror(errno);
+                if (errno == EACCES || errno == EPERM)
+                {
+                    error += " (see /proc/sys/kernel/perf_event_paranoid)";
+                }
+                closedir(tasks);
+                close();
+                return false;
+            }
+            leaders.push_back(leader);
+            for (int c = 1; c < (int)Counter::Count; c++)
+            {
+                int member = openEvent(configs[c], tid, leader);
+                if (member < 0)
+                {
+                    error = std::string("perf_event_open: ") + strerror(errno);
+                    closedir(tasks);
+                    close();
+                    return false;
+                }
+                members.push_back(member);
+            }
+        }
+        closedir(tasks);
+        return true;
+#else
+        error = "hardware counters need Linux perf events";
+        return false;
+#endif
+    }
+
+    void HardwareCounters::close()
+    {
+#ifdef __linux__
+        for (int fd : members)
+        {
+            ::close(fd);
+        }
+        for (int fd : leaders)
+        {
+            ::close(fd);
+        }
+#endif
+        members.clear();
+        leaders.clear();
+    }
+
+    bool HardwareCounters::isOpen() const
+    {
+        return !leaders.empty();
+    }
+
+    void HardwareCounters::read(uint64_t values[(int)Counter::Count]) const
+    {
+        for (int c = 0; c < (int)Counter::Count; c++)
+        {
+            values[c] = 0;
+        }
+#ifdef __linux__
+        // Group layout: nr, time enabled, time running, then one value per
+        // event. When the PMU is shared and the group was only scheduled part
+        // of the time, the counts are scaled up to the whole enabled time.
+        for (int fd : leaders)
+        {
+            uint64_t data[3 + (int)Counter::Count];
+            if (::read(fd, data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0)
+            {
+                continue;
+            }
+            double scale = (double)data[1] / data[2];
+            for (int c = 0; c < (int)Counter::Count; c++)
+            {
+                values[c] += (uint64_t)(data[3 + c] * scale);
+            }
+        }
+#endif
+    }
+}
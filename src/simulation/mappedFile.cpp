@@ -0,0 +1,54 @@
+#include "simulation/mappedFile.hpp"
+#include <fstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace sim
+{
+    MappedFile::MappedFile(const std::string &path) : data(nullptr), size(0)
+    {
+#ifndef _WIN32
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr != MAP_FAILED)
+            {
+                madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+                data = (const char *)ptr;
+                size = st.st_size;
+            }
+        }
+        close(fd);
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (file && file.tellg() > 0)
+        {
+            copy.resize(file.tellg());
+            file.seekg(0);
+            file.read(copy.data(), copy.size());
+            data = copy.data();
+            size = copy.size();
+        }
+#endif
+    }
+
+    MappedFile::~MappedFile()
+    {
+#ifndef _WIN32
+        if (data != nullptr)
+        {
+            munmap((void *)data, size);
+        }
+#endif
+    }
+}
@@ -0,0 +1,344 @@
+#include "simulation/octree.hpp"
+
+namespace sim
+{
+    Octree::Octree(ThreadPool &pool) : pool(pool), leafSize(8), visibleBodies(0), aggregatedCells(0), interactions(0)
+    {
+    }
+
+    void Octree::build(const std::vector<Body> &bodies, int leafSize)
+    {
+        this->leafSize = std::max(leafSize, 1);
+        int n = bodies.size();
+        nodes.clear();
+        order.resize(n);
+        scratch.resize(n);
+        positions.resize(n * 4);
+        sorted.resize(n * 4);
+        if (n == 0)
+        {
+            return;
+        }
+
+        float lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+        for (int i = 0; i < n; i++)
+        {
+            for (int d = 0; d < 3; d++)
+            {
+                float x = d < bodies[i].dimension ? bodies[i].coord[d] : 0.0f;
+                positions[i * 4 + d] = x;
+                lo[d] = std::min(lo[d], x);
+                hi[d] = std::max(hi[d], x);
+            }
+            positions[i * 4 + 3] = bodies[i].mass;
+            order[i] = i;
+        }
+
+        OctreeNode root;
+        root.halfSize = 0.0f;
+        for (int d = 0; d < 3; d++)
+        {
+            root.centre[d] = (lo[d] + hi[d]) / 2.0f;
+            root.halfSize = std::max(root.halfSize, (hi[d] - lo[d]) / 2.0f);
+        }
+        // Grow the root a little so the bodies on its faces fall inside it.
+        root.halfSize = root.halfSize * 1.001f + 1e-3f;
+        root.firstChild = -1;
+        root.numChildren = 0;
+        root.begin = 0;
+        root.end = n;
+        nodes.push_back(root);
+        split(0, 0);
+
+        pool.parallelFor(n, [&](int begin, int end)
+                         {
+            for (int k = begin; k < end; k++)
+            {
+                for (int d = 0; d < 4; d++)
+                {
+                    sorted[k * 4 + d] = positions[order[k] * 4 + d];
+                }
+            } });
+
+        // Children always come after their parent, so one backwards pass
+        // fills every node from finished children.
+        for (int i = nodes.size() - 1; i >= 0; i--)
+        {
+            OctreeNode &node = nodes[i];
+            double mass = 0, moment[3] = {0, 0, 0};
+            if (node.firstChild < 0)
+            {
+                for (int k = node.begin; k < node.end; k++)
+                {
+                    mass += sorted[k * 4 + 3];
+                    for (int d = 0; d < 3; d++)
+                    {
+                        moment[d] += (double)sorted[k * 4 + 3] * sorted[k * 4 + d];
+                    }
+                }
+            }
+            else
+            {
+                for (int c = node.firstChild; c < node.firstChild + node.numChildren; c++)
+                {
+                    mass += nodes[c].mass;
+                    for (int d = 0; d < 3; d++)
+                    {
+                        moment[d] += (double)nodes[c].mass * nodes[c].massCentre[d];
+                    }
+                }
+            }
+            node.mass = mass;
+            for (int d = 0; d < 3; d++)
+            {
+                node.massCentre[d] = mass > 0 ? moment[d] / mass : node.centre[d];
+            }
+        }
+    }
+
+    void Octree::split(int node, int depth)
+    {
+        OctreeNode parent = nodes[node];
+        if (parent.end - parent.begin <= leafSize || depth >= maxDepth)
+        {
+            return;
+        }
+
+        // Counting sort of the node's range by octant; bit d of the octant is
+        // set when the body lies on the upper side along axis d.
+        int counts[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        auto octant = [&](int i)
+        {
+            int oct = 0;
+            for (int d = 0; d < 3; d++)
+            {
+                if (positions[i * 4 + d] >= parent.centre[d])
+                {
+                    oct |= 1 << d;
+                }
+            }
+            return oct;
+        };
+        for (int k = parent.begin; k < parent.end; k++)
+        {
+            counts[octant(order[k])]++;
+        }
+        int offsets[8];
+        offsets[0] = parent.begin;
+        for (int o = 1; o < 8; o++)
+        {
+            offsets[o] = offsets[o - 1] + counts[o - 1];
+        }
+        int starts[8];
+        std::copy(offsets, offsets + 8, starts);
+        for (int k = parent.begin; k < parent.end; k++)
+        {
+            scratch[offsets[octant(order[k])]++] = order[k];
+        }
+        std::copy(scratch.begin() + parent.begin, scratch.begin() + parent.end, order.begin() + parent.begin);
+
+        int first = nodes.size();
+        float half = parent.halfSize / 2.0f;
+        for (int o = 0; o < 8; o++)
+        {
+            if (counts[o] == 0)
+            {
+                continue;
+            }
+            OctreeNode child;
+            for (int d = 0; d < 3; d++)
+            {
+                child.centre[d] = parent.centre[d] + ((o >> d) & 1 ? half : -half);
+            }
+            child.halfSize = half;
+            child.firstChild = -1;
+            child.numChildren = 0;
+            child.begin = starts[o];
+            child.end = starts[o] + counts[o];
+            nodes.push_back(child);
+        }
+        int numChildren = nodes.size() - first;
+        nodes[node].firstChild = first;
+        nodes[node].numChildren = numChildren;
+        for (int c = first; c < first + numChildren; c++)
+        {
+            split(c, depth + 1);
+        }
+    }
+
+    void Octree::accelerations(float G, float softening, float theta, std::vector<float> &acc, std::vector<float> &potential) const
+    {
+        int n = order.size();
+        acc.assign(n * 3, 0.0f);
+        potential.assign(n, 0.0f);
+        interactions = 0;
+        if (nodes.empty())
+        {
+            return;
+        }
+        float theta2 = theta * theta;
+        float eps2 = softening * softening;
+        pool.parallelFor(n, [&](int begin, int end)
+                         {
+            // Every pop pushes at most eight children, so the stack never
+            // holds more than 7 * maxDepth + 8 nodes.
+            int stack[8 * (maxDepth + 1)];
+            unsigned long long count = 0;
+            for (int k = begin; k < end; k++)
+            {
+                float px = sorted[k * 4], py = sorted[k * 4 + 1], pz = sorted[k * 4 + 2];
+                float ax = 0.0f, ay = 0.0f, az = 0.0f, phi = 0.0f;
+                int top = 0;
+                stack[top++] = 0;
+                while (top > 0)
+                {
+                    const OctreeNode &node = nodes[stack[--top]];
+                    if (node.firstChild < 0)
+                    {
+                        count += node.end - node.begin;
+                        for (int j = node.begin; j < node.end; j++)
+                        {
+                            float dx = sorted[j * 4] - px;
+                            float dy = sorted[j * 4 + 1] - py;
+                            float dz = sorted[j * 4 + 2] - pz;
+                            float invDist = 1.0f / std::sqrt(dx * dx + dy * dy + dz * dz + eps2);
+                            float s = sorted[j * 4 + 3] * invDist * invDist * invDist;
+                            ax += dx * s;
+                            ay += dy * s;
+                            az += dz * s;
+                            // A body adds no force to itself, but would add m / softening here.
+                            phi -= j != k ? sorted[j * 4 + 3] * invDist : 0.0f;
+                        }
+                        continue;
+                    }
+                    float dx = node.massCentre[0] - px;
+                    float dy = node.massCentre[1] - py;
+                    float dz = node.massCentre[2] - pz;
+                    float distSqr = dx * dx + dy * dy + dz * dz;
+                    float size = 2.0f * node.halfSize;
+                    if (size * size < theta2 * distSqr)
+                    {
+                        count++;
+                        float invDist = 1.0f / std::sqrt(distSqr + eps2);
+                        float s = node.mass * invDist * invDist * invDist;
+                        ax += dx * s;
+                        ay += dy * s;
+                        az += dz * s;
+                        phi -= node.mass * invDist;
+                    }
+                    else
+                    {
+                        for (int c = node.firstChild; c < node.firstChild + node.numChildren; c++)
+                        {
+                            stack[top++] = c;
+                        }
+                    }
+                }
+                int i = order[k];
+                acc[i * 3] = G * ax;
+                acc[i * 3 + 1] = G * ay;
+                acc[i * 3 + 2] = G * az;
+                potential[i] = G * phi;
+            }
+            interactions += count; });
+    }
+
+    void Octree::cull(const float planes[6][4], const float eye[3], float lodRatio, std::vector<float> &points)
+    {
+        points.clear();
+        visibleBodies = 0;
+        aggregatedCells = 0;
+        if (nodes.empty())
+        {
+            return;
+        }
+
+        // Each entry carries a mask of the planes its cell still straddles;
+        // cells found fully inside a plane drop it for all their children.
+        const float boundingScale = 1.7320508f;
+        std::vector<std::pair<int, int>> stack;
+        stack.push_back({0, 0x3f});
+        while (!stack.empty())
+        {
+            int index = stack.back().first;
+            int mask = stack.back().second;
+            stack.pop_back();
+            const OctreeNode &node = nodes[index];
+
+            float boundingRadius = node.halfSize * boundingScale;
+            bool outside = false;
+            for (int p = 0; p < 6 && !outside; p++)
+            {
+                if (mask & (1 << p))
+                {
+                    float dist = planes[p][0] * node.centre[0] + planes[p][1] * node.centre[1] +
+                                 planes[p][2] * node.centre[2] + planes[p][3];
+                    if (dist < -boundingRadius)
+                    {
+                        outside = true;
+                    }
+                    else if (dist > boundingRadius)
+                    {
+                        mask &= ~(1 << p);
+                    }
+                }
+            }
+            if (outside)
+            {
+                continue;
+            }
+
+            float dx = node.massCentre[0] - eye[0];
+            float dy = node.massCentre[1] - eye[1];
+            float dz = node.massCentre[2] - eye[2];
+            float dist = std::sqrt(dx * dx + dy * dy + dz * dz);
+            int count = node.end - node.begin;
+            if (count > 1 && 2.0f * node.halfSize < lodRatio * dist)
+            {
+                points.insert(points.end(), {node.massCentre[0], node.massCentre[1], node.massCentre[2], (float)count});
+                aggregatedCells++;
+                continue;
+            }
+            if (node.firstChild >= 0)
+            {
+                for (int c = node.firstChild; c < node.firstChild + node.numChildren; c++)
+                {
+                    stack.push_back({c, mask});
+                }
+                continue;
+            }
+            for (int k = node.begin; k < node.end; k++)
+            {
+                const float *p = &sorted[k * 4];
+                bool inside = true;
+                for (int q = 0; q < 6 && inside; q++)
+                {
+                    if (mask & (1 << q))
+                    {
+                        inside = planes[q][0] * p[0] + planes[q][1] * p[1] + planes[q][2] * p[2] + planes[q][3] >= 0.0f;
+                    }
+                }
+                if (inside)
+                {
+                    points.insert(points.end(), {p[0], p[1], p[2], 1.0f});
+                    visibleBodies++;
+                }
+            }
+        }
+    }
+
+    int Octree::getVisibleBodies() const
+    {
+        return visibleBodies;
+    }
+
+    int Octree::getAggregatedCells() const
+    {
+        return aggregatedCells;
+    }
+
+    unsigned long long Octree::getInteractions() const
+    {
+        return interactions;
+    }
+}
@@ -0,0 +1,196 @@
+#include "simulation/particleLoader.hpp"
+#include "simulation/mappedFile.hpp"
+#include <charconv>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <atomic>
+
+namespace sim
+{
+    namespace
+    {
+        bool isSeparator(char c)
+        {
+            return c == ',' || c == ';' || c == ' ' || c == '\t' || c == '\r';
+        }
+
+        // Returns the start of the line after ptr, or end.
+        const char *nextLine(const char *ptr, const char *end)
+        {
+            const char *newline = (const char *)memchr(ptr, '\n', end - ptr);
+            return newline != nullptr ? newline + 1 : end;
+        }
+
+        // A line is a record if its first non-separator character starts a
+        // number; blank lines, comments and the header are skipped.
+        bool isRecord(const char *ptr, const char *end)
+        {
+            while (ptr < end && isSeparator(*ptr))
+            {
+                ptr++;
+            }
+            return ptr < end && *ptr != '\n' && (isdigit((unsigned char)*ptr) || *ptr == '-' || *ptr == '+' || *ptr == '.');
+        }
+
+        bool parseRecord(const char *ptr, const char *end, int numValues, float *values)
+        {
+            for (int k = 0; k < numValues; k++)
+            {
+                while (ptr < end && isSeparator(*ptr))
+                {
+                    ptr++;
+                }
+                if (ptr < end && *ptr == '+')
+                {
+                    ptr++;
+                }
+                std::from_chars_result result = std::from_chars(ptr, end, values[k]);
+                if (result.ec != std::errc())
+                {
+                    return false;
+                }
+                ptr = result.ptr;
+            }
+            while (ptr < end && isSeparator(*ptr))
+            {
+                ptr++;
+            }
+            return ptr == end || *ptr == '\n';
+        }
+    }
+
+    ParticleLoader::ParticleLoader(ThreadPool &pool) : pool(pool), seconds(0.0), megabytesPerSecond(0.0)
+    {
+    }
+
+    bool ParticleLoader::load(const std::string &path, int dimension, std::vector<Body> &bodies, std::string &error)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        MappedFile file(path);
+        if (file.data == nullptr)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+        bool binary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+        bool ok = binary ? loadBinary(file.data, file.size, dimension, bodies, error)
+                         : loadText(file.data, file.size, dimension, bodies, error);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        megabytesPerSecond = file.size / 1048576.0 / std::max(seconds, 1e-9);
+        return ok;
+    }
+
+    double ParticleLoader::getSeconds() const
+    {
+        return seconds;
+    }
+
+    double ParticleLoader::getMegabytesPerSecond() const
+    {
+        return megabytesPerSecond;
+    }
+
+    bool ParticleLoader::loadText(const char *data, size_t size, int dimension, std::vector<Body> &bodies, std::string &error)
+    {
+        const char *end = data + size;
+        int numChunks = pool.size() * 4;
+        std::vector<const char *> chunkStart(numChunks + 1);
+        chunkStart[0] = data;
+        chunkStart[numChunks] = end;
+        for (int c = 1; c < numChunks; c++)
+        {
+            const char *ptr = data + size / numChunks * c;
+            chunkStart[c] = std::max(chunkStart[c - 1], ptr > data && ptr[-1] == '\n' ? ptr : nextLine(ptr, end));
+        }
+
+        std::vector<size_t> chunkOffset(numChunks + 1, 0);
+        pool.parallelFor(numChunks, [&](int begin, int finish)
+                         {
+            for (int c = begin; c < finish; c++)
+            {
+                size_t count = 0;
+                for (const char *ptr = chunkStart[c]; ptr < chunkStart[c + 1]; ptr = nextLine(ptr, end))
+                {
+                    count += isRecord(ptr, end);
+                }
+                chunkOffset[c + 1] = count;
+            } });
+        for (int c = 0; c < numChunks; c++)
+        {
+            chunkOffset[c + 1] += chunkOffset[c];
+        }
+        if (chunkOffset[numChunks] == 0)
+        {
+            error = "no bodies in file";
+            return false;
+        }
+
+        std::vector<Body> loaded(chunkOffset[numChunks], Body(dimension));
+        int numValues = 1 + 2 * dimension;
+        std::atomic<size_t> badRecord(loaded.size());
+        pool.parallelFor(numChunks, [&](int begin, int finish)
+                         {
+            float values[7];
+            for (int c = begin; c < finish; c++)
+            {
+                size_t i = chunkOffset[c];
+                for (const char *ptr = chunkStart[c]; ptr < chunkStart[c + 1]; ptr = nextLine(ptr, end))
+                {
+                    if (!isRecord(ptr, end))
+                    {
+                        continue;
+                    }
+                    if (!parseRecord(ptr, end, numValues, values))
+                    {
+                        size_t expected = badRecord;
+                        while (i < expected && !badRecord.compare_exchange_weak(expected, i))
+                        {
+                        }
+                        break;
+                    }
+                    loaded[i].mass = values[0];
+                    for (int j = 0; j < dimension; j++)
+                    {
+                        loaded[i].coord[j] = values[1 + j];
+                        loaded[i].veloc[j] = values[1 + dimension + j];
+                    }
+                    i++;
+                }
+            } });
+        if (badRecord < loaded.size())
+        {
+            error = "malformed record " + std::to_string(badRecord + 1) + ", expected " + std::to_string(numValues) + " values";
+            return false;
+        }
+        bodies = std::move(loaded);
+        return true;
+    }
+
+    bool ParticleLoader::loadBinary(const char *data, size_t size, int dimension, std::vector<Body> &bodies, std::string &error)
+    {
+        size_t recordSize = (1 + 2 * dimension) * sizeof(float);
+        if (size % recordSize != 0)
+        {
+            error = "file size is not a multiple of " + std::to_string(recordSize) + " bytes";
+            return false;
+        }
+        size_t n = size / recordSize;
+        std::vector<Body> loaded(n, Body(dimension));
+        pool.parallelFor(n, [&](int begin, int finish)
+                         {
+            for (int i = begin; i < finish; i++)
+            {
+                float values[7];
+                memcpy(values, data + (size_t)i * recordSize, recordSize);
+                loaded[i].mass = values[0];
+                for (int j = 0; j < dimension; j++)
+                {
+                    loaded[i].coord[j] = values[1 + j];
+                    loaded[i].veloc[j] = values[1 + dimension + j];
+                }
+            } });
+        bodies = std::move(loaded);
+        return true;
+    }
+}
@@ -0,0 +1,200 @@
+#include "simulation/profiler.hpp"
+#include "simulation/trace.hpp"
+
+namespace sim
+{
+    Profiler::Profiler(int historyLength)
+        : historyLength(std::max(historyLength, 1)), head(0), frames(0), frameStart(Clock::now()),
+          frameSeconds(this->historyLength, 0.0f), steps(this->historyLength, 0.0),
+          interactions(this->historyLength, 0.0), bytes(this->historyLength, 0.0),
+          currentSteps(0.0), currentInteractions(0.0), currentBytes(0.0), counters(nullptr)
+    {
+        for (int p = 0; p < (int)Phase::Count; p++)
+        {
+            current[p] = 0.0;
+            history[p].assign(this->historyLength, 0.0f);
+            for (int c = 0; c < (int)Counter::Count; c++)
+            {
+                currentCounts[p][c] = 0.0;
+                counterHistory[p][c].assign(this->historyLength, 0.0);
+            }
+        }
+    }
+
+    void Profiler::begin(Phase phase)
+    {
+        if (counters != nullptr)
+        {
+            counters->read(counterStart[(int)phase]);
+        }
+        started[(int)phase] = traceNow();
+    }
+
+    void Profiler::end(Phase phase)
+    {
+        uint64_t now = traceNow();
+        current[(int)phase] += (now - started[(int)phase]) / 1e6;
+        traceEvent(getName(phase), started[(int)phase], now);
+        if (counters != nullptr)
+        {
+            // Scaled counts of multiplexed groups are estimates and can step
+            // back slightly, so negative deltas are dropped.
+            uint64_t values[(int)Counter::Count];
+            counters->read(values);
+            for (int c = 0; c < (int)Counter::Count; c++)
+            {
+                currentCounts[(int)phase][c] += std::max((double)values[c] - (double)counterStart[(int)phase][c], 0.0);
+            }
+        }
+    }
+
+    void Profiler::addSteps(int steps)
+    {
+        currentSteps += steps;
+    }
+
+    void Profiler::addInteractions(unsigned long long interactions)
+    {
+        currentInteractions += interactions;
+    }
+
+    void Profiler::addBytesUploaded(unsigned long long bytes)
+    {
+        currentBytes += bytes;
+    }
+
+    void Profiler::setCounters(HardwareCounters *counters)
+    {
+        this->counters = counters;
+    }
+
+    void Profiler::endFrame()
+    {
+        Clock::time_point now = Clock::now();
+        frameSeconds[head] = std::chrono::duration<float>(now - frameStart).count();
+        frameStart = now;
+        for (int p = 0; p < (int)Phase::Count; p++)
+        {
+            history[p][head] = current[p];
+            current[p] = 0.0;
+            for (int c = 0; c < (int)Counter::Count; c++)
+            {
+                counterHistory[p][c][head] = currentCounts[p][c];
+                currentCounts[p][c] = 0.0;
+            }
+        }
+        steps[head] = currentSteps;
+        interactions[head] = currentInteractions;
+        bytes[head] = currentBytes;
+        currentSteps = 0.0;
+        currentInteractions = 0.0;
+        currentBytes = 0.0;
+        head = (head + 1) % historyLength;
+        frames = std::min(frames + 1, historyLength);
+    }
+
+    const char *Profiler::getName(Phase phase)
+    {
+        static const char *names[] = {"Tree build", "Force walk", "Collisions", "Integration",
+                                      "Staging copy", "GL upload", "ImGui", "Swap"};
+        return names[(int)phase];
+    }
+
+    const std::vector<float> &Profiler::getHistory(Phase phase) const
+    {
+        return history[(int)phase];
+    }
+
+    int Profiler::getHead() const
+    {
+        return head;
+    }
+
+    float Profiler::getPercentile(Phase phase, float percentile) const
+    {
+        if (frames == 0)
+        {
+            return 0.0f;
+        }
+        // Until the history is full, the recorded frames are the ones before head.
+        const std::vector<float> &values = history[(int)phase];
+        if (frames < historyLength)
+        {
+            sorted.assign(values.begin(), values.begin() + frames);
+        }
+        else
+        {
+            sorted = values;
+        }
+        int k = std::min((int)(percentile / 100.0f * sorted.size()), (int)sorted.size() - 1);
+        std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+        return sorted[k];
+    }
+
+    double Profiler::getStepsPerSecond() const
+    {
+        double seconds = 0.0, total = 0.0;
+        for (int i = 0; i < historyLength; i++)
+        {
+            seconds += frameSeconds[i];
+            total += steps[i];
+        }
+        return seconds > 0.0 ? total / seconds : 0.0;
+    }
+
+    double Profiler::getInteractionsPerSecond() const
+    {
+        double seconds = 0.0, total = 0.0;
+        for (int i = 0; i < historyLength; i++)
+        {
+            seconds += frameSeconds[i];
+            total += interactions[i];
+        }
+        return seconds > 0.0 ? total / seconds : 0.0;
+    }
+
+    double Profiler::getBytesPerFrame() const
+    {
+        double total = 0.0;
+        for (int i = 0; i < historyLength; i++)
+        {
+            total += bytes[i];
+        }
+        return frames > 0 ? total / frames : 0.0;
+    }
+
+    double Profiler::getFrameMilliseconds() const
+    {
+        double seconds = 0.0;
+        for (int i = 0; i < historyLength; i++)
+        {
+            seconds += frameSeconds[i];
+        }
+        return frames > 0 ? seconds * 1000.0 / frames : 0.0;
+    }
+
+    bool Profiler::hasCounters() const
+    {
+        return counters != nullptr;
+    }
+
+    double Profiler::getCounterTotal(Phase phase, Counter counter) const
+    {
+        double total = 0.0;
+        for (int i = 0; i < historyLength; i++)
+        {
+            total += counterHistory[(int)phase][(int)counter][i];
+        }
+        return total;
+    }
+
+    ProfileScope::ProfileScope(Profiler &profiler, Phase phase) : profiler(profiler), phase(phase)
+    {
+        profiler.begin(phase);
+    }
+
+    ProfileScope::~ProfileScope()
+    {
+        profiler.end(phase);
+    }
+}
@@ -101,7 +101,7 @@ namespace sim
         }
     }
 
-    std::vector<float> QuadTree::calForce(Body body, float G, float alpha, float theta)
+    std::vector<float> QuadTree::calForce(Body body, float G, float alpha, float theta, unsigned long long &interactions, float &potential)
     {
         if (mass == 0)
         {
@@ -120,11 +120,13 @@ namespace sim
                     continue;
                 }
                 distSqr += alpha * alpha;
+                interactions++;
                 float invDist = 1.0 / sqrt(distSqr);
                 float invDist3 = invDist * invDist * invDist;
 
                 ret[0] += G * bodies[i].mass * dx * invDist3;
                 ret[1] += G * bodies[i].mass * dy * invDist3;
+                potential -= G * bodies[i].mass * invDist;
             }
             return ret;
         }
@@ -138,7 +140,7 @@ namespace sim
                 {
                     if (children[i][j] != nullptr)
                     {
-                        std::vector<float> tmp = children[i][j]->calForce(body, G, alpha, theta);
+                        std::vector<float> tmp = children[i][j]->calForce(body, G, alpha, theta, interactions, potential);
                         ret[0] += tmp[0];
                         ret[1] += tmp[1];
                     }
@@ -151,6 +153,7 @@ namespace sim
         if ((upBorder - downBorder) / s <= theta)
         {
             std::vector<float> ret(2, 0);
+            interactions++;
             float dx = massCentreX - body.coord[0];
             float dy = massCentreY - body.coord[1];
             float distSqr = dx * dx + dy * dy + alpha * alpha;
@@ -159,6 +162,7 @@ namespace sim
 
             ret[0] += G * mass * dx * invDist3 / 1000.0;
             ret[1] += G * mass * dy * invDist3 / 1000.0;
+            potential -= G * mass * invDist / 1000.0;
             return ret;
         }
         else
@@ -170,7 +174,7 @@ namespace sim
                 {
                     if (children[i][j] != nullptr)
                     {
-                        std::vector<float> tmp = children[i][j]->calForce(body, G, alpha, theta);
+                        std::vector<float> tmp = children[i][j]->calForce(body, G, alpha, theta, interactions, potential);
                         ret[0] += tmp[0];
                         ret[1] += tmp[1];
                     }
@@ -0,0 +1,193 @@
+#include "simulation/regularization.hpp"
+
+namespace sim
+{
+    Regularization::Regularization(double G, double encounterDistance, int subSteps)
+        : G(G), encounterDistance(encounterDistance), subSteps(subSteps), maxIterations(subSteps * 256), n(0), dimension(0),
+          cappedSteps(0), shortfall(0), lostTime(0)
+    {
+    }
+
+    bool Regularization::closeEncounter(const std::vector<Body> &bodies) const
+    {
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            for (int k = i + 1; k < bodies.size(); k++)
+            {
+                double distSqr = 0;
+                for (int l = 0; l < bodies[i].dimension; l++)
+                {
+                    double d = bodies[k].coord[l] - bodies[i].coord[l];
+                    distSqr += d * d;
+                }
+                if (distSqr < encounterDistance * encounterDistance)
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void Regularization::advance(std::vector<Body> &bodies, double deltaTime)
+    {
+        n = bodies.size();
+        if (n < 2 || deltaTime <= 0)
+        {
+            return;
+        }
+        dimension = bodies[0].dimension;
+        mass.resize(n);
+        coord.resize(n * dimension);
+        veloc.resize(n * dimension);
+        accel.resize(n * dimension);
+        for (int i = 0; i < n; i++)
+        {
+            mass[i] = bodies[i].mass;
+            for (int j = 0; j < dimension; j++)
+            {
+                coord[i * dimension + j] = bodies[i].coord[j];
+                veloc[i * dimension + j] = bodies[i].veloc[j];
+            }
+        }
+
+        // Binding energy B = -E stays constant for an isolated system, so the
+        // drift weight T + B equals U along the exact solution.
+        double binding = potentialEnergy() - kineticEnergy();
+        double target = deltaTime + shortfall;
+        double ds = target / subSteps * potentialEnergy();
+        double t = 0;
+        for (int it = 0; it < maxIterations && t < target; it++)
+        {
+            double h = std::min(ds, (target - t) * potentialEnergy());
+
+            double weight = kineticEnergy() + binding;
+            double dt = weight > 0 ? 0.5 * h / weight : 0.5 * h / potentialEnergy();
+            drift(dt);
+            t += dt;
+
+            acceleration();
+            dt = h / potentialEnergy();
+            for (int i = 0; i < n * dimension; i++)
+            {
+                veloc[i] += accel[i] * dt;
+            }
+
+            weight = kineticEnergy() + binding;
+            dt = weight > 0 ? 0.5 * h / weight : 0.5 * h / potentialEnergy();
+            drift(dt);
+            t += dt;
+        }
+        shortfall = 0;
+        if (t < target)
+        {
+            cappedSteps++;
+            shortfall = std::min(target - t, deltaTime);
+            lostTime += target - t - shortfall;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < dimension; j++)
+            {
+                bodies[i].coord[j] = coord[i * dimension + j];
+                bodies[i].veloc[j] = veloc[i * dimension + j];
+            }
+        }
+    }
+
+    void Regularization::endEncounter()
+    {
+        lostTime += shortfall;
+        shortfall = 0;
+    }
+
+    void Regularization::reset()
+    {
+        cappedSteps = 0;
+        shortfall = 0;
+        lostTime = 0;
+    }
+
+    int Regularization::getCappedSteps() const
+    {
+        return cappedSteps;
+    }
+
+    double Regularization::getShortfall() const
+    {
+        return shortfall;
+    }
+
+    double Regularization::getLostTime() const
+    {
+        return lostTime;
+    }
+
+    double Regularization::kineticEnergy() const
+    {
+        double T = 0;
+        for (int i = 0; i < n; i++)
+        {
+            double vSqr = 0;
+            for (int j = 0; j < dimension; j++)
+            {
+                vSqr += veloc[i * dimension + j] * veloc[i * dimension + j];
+            }
+            T += 0.5 * mass[i] * vSqr;
+        }
+        return T;
+    }
+
+    double Regularization::potentialEnergy() const
+    {
+        double U = 0;
+        for (int i = 0; i < n; i++)
+        {
+            for (int k = i + 1; k < n; k++)
+            {
+                double distSqr = 0;
+                for (int j = 0; j < dimension; j++)
+                {
+                    double d = coord[k * dimension + j] - coord[i * dimension + j];
+                    distSqr += d * d;
+                }
+                U += G * mass[i] * mass[k] / sqrt(distSqr);
+            }
+        }
+        return U;
+    }
+
+    void Regularization::acceleration()
+    {
+        std::fill(accel.begin(), accel.end(), 0.0);
+        for (int i = 0; i < n; i++)
+        {
+            for (int k = i + 1; k < n; k++)
+            {
+                double d[3] = {0, 0, 0};
+                double distSqr = 0;
+                for (int j = 0; j < dimension; j++)
+                {
+                    d[j] = coord[k * dimension + j] - coord[i * dimension + j];
+                    distSqr += d[j] * d[j];
+                }
+                double invDist = 1.0 / sqrt(distSqr);
+                double invDist3 = invDist * invDist * invDist;
+                for (int j = 0; j < dimension; j++)
+                {
+                    accel[i * dimension + j] += G * mass[k] * d[j] * invDist3;
+                    accel[k * dimension + j] -= G * mass[i] * d[j] * invDist3;
+                }
+            }
+        }
+    }
+
+    void Regularization::drift(double dt)
+    {
+        for (int i = 0; i < n * dimension; i++)
+        {
+            coord[i] += veloc[i] * dt;
+        }
+    }
+}
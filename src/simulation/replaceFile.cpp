@@ -0,0 +1,18 @@
+#include "simulation/replaceFile.hpp"
+#include <cstdio>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace sim
+{
+    bool replaceFile(const std::string &tmpPath, const std::string &path)
+    {
+#ifndef _WIN32
+        return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+#else
+        return MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#endif
+    }
+}
@@ -0,0 +1,232 @@
+#include "simulation/replayBuffer.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace sim
+{
+    namespace
+    {
+        const float boundsMargin = 0.1f;
+
+        void writeVarint(std::vector<uint8_t> &bytes, int32_t value)
+        {
+            uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+            while (zigzag >= 0x80)
+            {
+                bytes.push_back((uint8_t)(zigzag | 0x80));
+                zigzag >>= 7;
+            }
+            bytes.push_back((uint8_t)zigzag);
+        }
+
+        int32_t readVarint(const uint8_t *&ptr)
+        {
+            uint32_t zigzag = 0;
+            int shift = 0;
+            while (*ptr & 0x80)
+            {
+                zigzag |= (uint32_t)(*ptr++ & 0x7F) << shift;
+                shift += 7;
+            }
+            zigzag |= (uint32_t)(*ptr++) << shift;
+            return (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        }
+    }
+
+    ReplayBuffer::ReplayBuffer(size_t memoryBudget, int keyframeInterval)
+        : cachedFrame(-1), memoryBudget(memoryBudget), memoryUsed(0), rawBytes(0),
+          keyframeInterval(keyframeInterval), sinceKeyframe(0)
+    {
+    }
+
+    void ReplayBuffer::clear()
+    {
+        frames.clear();
+        lastQuantised.clear();
+        cachedQuantised.clear();
+        cachedFrame = -1;
+        memoryUsed = 0;
+        rawBytes = 0;
+        sinceKeyframe = 0;
+    }
+
+    void ReplayBuffer::encodeKeyframe(Frame &frame, const std::vector<Body> &bodies)
+    {
+        frame.keyframe = true;
+        for (int j = 0; j < frame.dimension; j++)
+        {
+            float lo = bodies[0].coord[j], hi = bodies[0].coord[j];
+            for (int i = 1; i < frame.count; i++)
+            {
+                lo = std::min(lo, bodies[i].coord[j]);
+                hi = std::max(hi, bodies[i].coord[j]);
+            }
+            float margin = std::max((hi - lo) * boundsMargin, 1.0f);
+            frame.origin[j] = lo - margin;
+            frame.step[j] = (hi - lo + 2.0f * margin) / 65535.0f;
+        }
+        lastQuantised.resize((size_t)frame.count * frame.dimension);
+        frame.bytes.resize((size_t)frame.count * frame.dimension * sizeof(uint16_t));
+        uint8_t *out = frame.bytes.data();
+        for (int i = 0; i < frame.count; i++)
+        {
+            for (int j = 0; j < frame.dimension; j++)
+            {
+                uint16_t q = (uint16_t)std::lround((bodies[i].coord[j] - frame.origin[j]) / frame.step[j]);
+                lastQuantised[i * frame.dimension + j] = q;
+                *out++ = q & 0xFF;
+                *out++ = q >> 8;
+            }
+        }
+    }
+
+    void ReplayBuffer::push(const std::vector<Body> &bodies, int dimension)
+    {
+        if (bodies.empty())
+        {
+            return;
+        }
+        Frame frame;
+        frame.count = bodies.size();
+        frame.dimension = dimension;
+        bool keyframe = frames.empty() || sinceKeyframe >= keyframeInterval ||
+                        frames.back().count != frame.count || frames.back().dimension != dimension;
+        if (!keyframe)
+        {
+            const Frame &previous = frames.back();
+            for (int j = 0; j < dimension; j++)
+            {
+                frame.origin[j] = previous.origin[j];
+                frame.step[j] = previous.step[j];
+            }
+            for (int i = 0; i < frame.count && !keyframe; i++)
+            {
+                for (int j = 0; j < dimension; j++)
+                {
+                    float t = (bodies[i].coord[j] - frame.origin[j]) / frame.step[j];
+                    if (!(t >= 0.0f && t <= 65535.0f))
+                    {
+                        keyframe = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (keyframe)
+        {
+            encodeKeyframe(frame, bodies);
+            sinceKeyframe = 0;
+        }
+        else
+        {
+            frame.keyframe = false;
+            frame.bytes.reserve((size_t)frame.count * dimension);
+            for (int i = 0; i < frame.count; i++)
+            {
+                for (int j = 0; j < dimension; j++)
+                {
+                    uint16_t q = (uint16_t)std::lround((bodies[i].coord[j] - frame.origin[j]) / frame.step[j]);
+                    writeVarint(frame.bytes, (int32_t)q - (int32_t)lastQuantised[i * dimension + j]);
+                    lastQuantised[i * dimension + j] = q;
+                }
+            }
+            frame.bytes.shrink_to_fit();
+            sinceKeyframe++;
+        }
+        memoryUsed += frame.bytes.size() + sizeof(Frame);
+        rawBytes += (size_t)frame.count * dimension * sizeof(float);
+        frames.push_back(std::move(frame));
+        evict();
+    }
+
+    void ReplayBuffer::evict()
+    {
+        while (memoryUsed > memoryBudget && frames.size() > 1)
+        {
+            int removed = 0;
+            do
+            {
+                memoryUsed -= frames.front().bytes.size() + sizeof(Frame);
+                rawBytes -= (size_t)frames.front().count * frames.front().dimension * sizeof(float);
+                frames.pop_front();
+                removed++;
+            } while (frames.size() > 1 && !frames.front().keyframe);
+            if (!frames.front().keyframe)
+            {
+                clear();
+                return;
+            }
+            cachedFrame -= removed;
+            if (cachedFrame < 0)
+            {
+                cachedFrame = -1;
+            }
+        }
+    }
+
+    int ReplayBuffer::decode(int frame, std::vector<float> &coords, float scale)
+    {
+        if (frame < 0 || frame >= (int)frames.size())
+        {
+            return 0;
+        }
+        int start = frame;
+        while (!frames[start].keyframe)
+        {
+            start--;
+        }
+        int first;
+        if (cachedFrame >= start && cachedFrame <= frame)
+        {
+            first = cachedFrame + 1;
+        }
+        else
+        {
+            const Frame &key = frames[start];
+            cachedQuantised.resize((size_t)key.count * key.dimension);
+            const uint8_t *ptr = key.bytes.data();
+            for (size_t k = 0; k < cachedQuantised.size(); k++, ptr += 2)
+            {
+                cachedQuantised[k] = ptr[0] | (ptr[1] << 8);
+            }
+            first = start + 1;
+        }
+        for (int f = first; f <= frame; f++)
+        {
+            const uint8_t *ptr = frames[f].bytes.data();
+            for (size_t k = 0; k < cachedQuantised.size(); k++)
+            {
+                cachedQuantised[k] += readVarint(ptr);
+            }
+        }
+        cachedFrame = frame;
+
+        const Frame &current = frames[frame];
+        coords.resize(cachedQuantised.size());
+        for (int i = 0; i < current.count; i++)
+        {
+            for (int j = 0; j < current.dimension; j++)
+            {
+                size_t k = (size_t)i * current.dimension + j;
+                coords[k] = (current.origin[j] + cachedQuantised[k] * current.step[j]) * scale;
+            }
+        }
+        return current.count;
+    }
+
+    int ReplayBuffer::size() const
+    {
+        return frames.size();
+    }
+
+    size_t ReplayBuffer::getMemoryUsed() const
+    {
+        return memoryUsed;
+    }
+
+    double ReplayBuffer::getCompressionRatio() const
+    {
+        return memoryUsed > 0 ? (double)rawBytes / memoryUsed : 0.0;
+    }
+}
@@ -0,0 +1,307 @@
+#include "simulation/snapshot.hpp"
+#include "simulation/mappedFile.hpp"
+#include "simulation/replaceFile.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <fstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace sim
+{
+    namespace
+    {
+        const char snapshotMagic[8] = {'N', 'B', 'S', 'N', 'A', 'P', '\r', '\n'};
+        const uint32_t snapshotVersion = 1;
+
+        enum BlockTag : uint32_t
+        {
+            MassBlock = 1,
+            CoordBlock = 2,
+            VelocBlock = 3,
+            IdBlock = 4
+        };
+
+        enum Flags : uint32_t
+        {
+            TrailFlag = 1,
+            WallsFlag = 2,
+            CollisionsFlag = 4,
+            MergingFlag = 8
+        };
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t headerSize;
+            uint64_t numOfBodies;
+            uint32_t option;
+            uint32_t dimension;
+            uint32_t numBlocks;
+            uint32_t flags;
+            float radius;
+            float restitution;
+            uint32_t reserved;
+            uint32_t checksum;
+        };
+
+        struct BlockHeader
+        {
+            uint32_t tag;
+            uint32_t component;
+            uint64_t size;
+            uint32_t checksum;
+            uint32_t reserved;
+        };
+
+        void writeBlock(std::ofstream &file, uint32_t tag, uint32_t component, const std::vector<char> &data)
+        {
+            BlockHeader block = {tag, component, data.size(), crc32(data.data(), data.size()), 0};
+            file.write((const char *)&block, sizeof(block));
+            file.write(data.data(), data.size());
+        }
+    }
+
+    uint32_t crc32(const void *data, size_t size, uint32_t crc)
+    {
+        static uint32_t table[256];
+        static bool initialised = false;
+        if (!initialised)
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                table[i] = c;
+            }
+            initialised = true;
+        }
+        const unsigned char *bytes = (const unsigned char *)data;
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    bool saveSnapshot(const std::string &path, const SnapshotInfo &info,
+                      const std::vector<Body> &bodies, const std::vector<int> &ids)
+    {
+        uint64_t n = bodies.size();
+        Header header;
+        memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+        header.version = snapshotVersion;
+        header.headerSize = sizeof(Header);
+        header.numOfBodies = n;
+        header.option = info.option;
+        header.dimension = info.dimension;
+        header.numBlocks = 2 + 2 * info.dimension;
+        header.flags = (info.trail ? (uint32_t)TrailFlag : 0u) | (info.walls ? (uint32_t)WallsFlag : 0u) |
+                       (info.collisions ? (uint32_t)CollisionsFlag : 0u) | (info.merging ? (uint32_t)MergingFlag : 0u);
+        header.radius = info.radius;
+        header.restitution = info.restitution;
+        header.reserved = 0;
+        header.checksum = crc32(&header, offsetof(Header, checksum));
+
+        std::string tmpPath = path + ".tmp";
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            return false;
+        }
+        file.write((const char *)&header, sizeof(header));
+
+        std::vector<char> data(n * sizeof(float));
+        float *values = (float *)data.data();
+        for (uint64_t i = 0; i < n; i++)
+        {
+            values[i] = bodies[i].mass;
+        }
+        writeBlock(file, MassBlock, 0, data);
+        for (int j = 0; j < info.dimension; j++)
+        {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                values[i] = bodies[i].coord[j];
+            }
+            writeBlock(file, CoordBlock, j, data);
+        }
+        for (int j = 0; j < info.dimension; j++)
+        {
+            for (uint64_t i = 0; i < n; i++)
+            {
+                values[i] = bodies[i].veloc[j];
+            }
+            writeBlock(file, VelocBlock, j, data);
+        }
+        int32_t *idValues = (int32_t *)data.data();
+        for (uint64_t i = 0; i < n; i++)
+        {
+            idValues[i] = i < ids.size() ? ids[i] : i;
+        }
+        writeBlock(file, IdBlock, 0, data);
+
+        file.flush();
+        bool ok = (bool)file;
+        file.close();
+        if (!ok)
+        {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+#ifndef _WIN32
+        int fd = open(tmpPath.c_str(), O_RDONLY);
+        if (fd >= 0)
+        {
+            fsync(fd);
+            close(fd);
+        }
+#endif
+        if (!replaceFile(tmpPath, path))
+        {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool loadSnapshot(ThreadPool &pool, const std::string &path, SnapshotInfo &info,
+                      std::vector<Body> &bodies, std::vector<int> &ids, std::string &error)
+    {
+        MappedFile file(path);
+        if (file.data == nullptr)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+        if (file.size < sizeof(Header))
+        {
+            error = "file too small";
+            return false;
+        }
+        Header header;
+        memcpy(&header, file.data, sizeof(header));
+        if (memcmp(header.magic, snapshotMagic, sizeof(snapshotMagic)) != 0)
+        {
+            error = "not a snapshot file";
+            return false;
+        }
+        if (header.version != snapshotVersion || header.headerSize != sizeof(Header))
+        {
+            error = "unsupported snapshot version";
+            return false;
+        }
+        if (header.checksum != crc32(&header, offsetof(Header, checksum)))
+        {
+            error = "header checksum mismatch";
+            return false;
+        }
+        if (header.dimension < 2 || header.dimension > 3)
+        {
+            error = "bad dimension";
+            return false;
+        }
+
+        // Every block holds n floats, so a count the file cannot hold is
+        // rejected before it is used in a size; the cap on int also keeps it
+        // within what parallelFor can index.
+        if (header.numOfBodies > (uint64_t)INT_MAX || header.numOfBodies > file.size / sizeof(float))
+        {
+            error = "bad body count";
+            return false;
+        }
+        int n = header.numOfBodies;
+        int dimension = header.dimension;
+        std::vector<const float *> mass(1, nullptr), coord(header.dimension, nullptr), veloc(header.dimension, nullptr);
+        const int32_t *idValues = nullptr;
+        size_t offset = sizeof(Header);
+        for (uint32_t b = 0; b < header.numBlocks; b++)
+        {
+            BlockHeader block;
+            if (offset + sizeof(block) > file.size)
+            {
+                error = "truncated file";
+                return false;
+            }
+            memcpy(&block, file.data + offset, sizeof(block));
+            offset += sizeof(block);
+            if (block.size != (uint64_t)n * sizeof(float) || block.size > file.size - offset)
+            {
+                error = "bad block size";
+                return false;
+            }
+            const char *data = file.data + offset;
+            if (crc32(data, block.size) != block.checksum)
+            {
+                error = "block checksum mismatch";
+                return false;
+            }
+            offset += block.size;
+            if (block.tag == MassBlock)
+            {
+                mass[0] = (const float *)data;
+            }
+            else if (block.tag == CoordBlock && block.component < header.dimension)
+            {
+                coord[block.component] = (const float *)data;
+            }
+            else if (block.tag == VelocBlock && block.component < header.dimension)
+            {
+                veloc[block.component] = (const float *)data;
+            }
+            else if (block.tag == IdBlock)
+            {
+                idValues = (const int32_t *)data;
+            }
+        }
+        for (int j = 0; j < dimension; j++)
+        {
+            if (coord[j] == nullptr || veloc[j] == nullptr)
+            {
+                error = "missing block";
+                return false;
+            }
+        }
+        if (mass[0] == nullptr)
+        {
+            error = "missing block";
+            return false;
+        }
+
+        // Constructing the bodies is serial; the copy out of the mapping runs
+        // in parallel.
+        bodies.assign(n, Body(dimension));
+        ids.resize(n);
+        pool.parallelFor(n, [&](int begin, int end)
+                         {
+            for (int i = begin; i < end; i++)
+            {
+                bodies[i].mass = mass[0][i];
+                for (int j = 0; j < dimension; j++)
+                {
+                    bodies[i].coord[j] = coord[j][i];
+                    bodies[i].veloc[j] = veloc[j][i];
+                }
+                ids[i] = idValues != nullptr ? idValues[i] : i;
+            } });
+
+        info.option = header.option;
+        info.dimension = header.dimension;
+        info.radius = header.radius;
+        info.restitution = header.restitution;
+        info.trail = header.flags & TrailFlag;
+        info.walls = header.flags & WallsFlag;
+        info.collisions = header.flags & CollisionsFlag;
+        info.merging = header.flags & MergingFlag;
+        return true;
+    }
+}
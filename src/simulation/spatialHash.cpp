@@ -0,0 +1,110 @@
+#include "simulation/spatialHash.hpp"
+
+namespace sim
+{
+    SpatialHash::SpatialHash() : cellSize(1.0f), mask(0)
+    {
+    }
+
+    long long SpatialHash::cellOf(float coord) const
+    {
+        return (long long)std::floor(coord / cellSize);
+    }
+
+    unsigned int SpatialHash::hashCell(long long x, long long y, long long z) const
+    {
+        unsigned long long h = (unsigned long long)x * 73856093ULL ^
+                               (unsigned long long)y * 19349663ULL ^
+                               (unsigned long long)z * 83492791ULL;
+        return (unsigned int)(h ^ (h >> 32)) & mask;
+    }
+
+    void SpatialHash::build(const std::vector<Body> &bodies, float cellSize)
+    {
+        this->cellSize = cellSize;
+        int n = bodies.size();
+        unsigned int tableSize = 1;
+        while (tableSize < 2 * (unsigned int)n)
+        {
+            tableSize <<= 1;
+        }
+        mask = tableSize - 1;
+
+        cellStart.assign(tableSize + 1, 0);
+        cellBodies.resize(n);
+        bodyHash.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            long long z = bodies[i].dimension > 2 ? cellOf(bodies[i].coord[2]) : 0;
+            bodyHash[i] = hashCell(cellOf(bodies[i].coord[0]), cellOf(bodies[i].coord[1]), z);
+            cellStart[bodyHash[i] + 1]++;
+        }
+        for (unsigned int h = 0; h < tableSize; h++)
+        {
+            cellStart[h + 1] += cellStart[h];
+        }
+        cellCursor.assign(cellStart.begin(), cellStart.end() - 1);
+        for (int i = 0; i < n; i++)
+        {
+            cellBodies[cellCursor[bodyHash[i]]++] = i;
+        }
+    }
+
+    void SpatialHash::findContacts(const std::vector<Body> &bodies, float radius, std::vector<Contact> &contacts) const
+    {
+        findContacts(bodies, radius, 0, bodies.size(), contacts);
+    }
+
+    void SpatialHash::findContacts(const std::vector<Body> &bodies, float radius, int begin, int end, std::vector<Contact> &contacts) const
+    {
+        contacts.clear();
+        float rSum = 2 * radius;
+        for (int i = begin; i < end; i++)
+        {
+            const Body &a = bodies[i];
+            int dz = a.dimension > 2 ? 1 : 0;
+            long long x = cellOf(a.coord[0]);
+            long long y = cellOf(a.coord[1]);
+            long long z = a.dimension > 2 ? cellOf(a.coord[2]) : 0;
+
+            unsigned int visited[27];
+            int numVisited = 0;
+            for (long long ox = -1; ox <= 1; ox++)
+            {
+                for (long long oy = -1; oy <= 1; oy++)
+                {
+                    for (long long oz = -dz; oz <= dz; oz++)
+                    {
+                        unsigned int h = hashCell(x + ox, y + oy, z + oz);
+                        if (std::find(visited, visited + numVisited, h) != visited + numVisited)
+                        {
+                            continue;
+                        }
+                        visited[numVisited++] = h;
+
+                        for (int idx = cellStart[h]; idx < cellStart[h + 1]; idx++)
+                        {
+                            int k = cellBodies[idx];
+                            if (k <= i)
+                            {
+                                continue;
+                            }
+                            float distSqr = 0.0f;
+                            for (int l = 0; l < a.dimension; l++)
+                            {
+                                float d = a.coord[l] - bodies[k].coord[l];
+                                distSqr += d * d;
+                            }
+                            if (distSqr <= rSum * rSum)
+                            {
+                                contacts.push_back({i, k});
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        std::sort(contacts.begin(), contacts.end(), [](const Contact &a, const Contact &b)
+                  { return a.i != b.i ? a.i < b.i : a.k < b.k; });
+    }
+}
@@ -0,0 +1,201 @@
+#include "simulation/stabilityMap.hpp"
+
+namespace sim
+{
+    StabilityMap::StabilityMap(ThreadPool &pool) : pool(pool), width(0), height(0), n(0), movable(0)
+    {
+    }
+
+    const std::vector<float> &StabilityMap::getExponents() const
+    {
+        return exponents;
+    }
+
+    void StabilityMap::compute(const std::vector<Body> &bodies, int movable, int varied,
+                               float xMin, float xMax, float yMin, float yMax, int width, int height,
+                               double G, double alpha, double deltaTime, double duration,
+                               const std::atomic<bool> &cancel)
+    {
+        this->width = width;
+        this->height = height;
+        this->n = bodies.size();
+        this->movable = movable;
+        this->G = G;
+        this->alphaSqr = alpha * alpha;
+        this->deltaTime = deltaTime;
+        this->duration = duration;
+        mass.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            mass[i] = bodies[i].mass;
+        }
+        exponents.assign(width * height, std::numeric_limits<float>::quiet_NaN());
+
+        pool.parallelFor(height, [&](int begin, int end)
+                         {
+            std::vector<double> coord(2 * n), veloc(2 * n);
+            for (int row = begin; row < end && !cancel; row++)
+            {
+                for (int col = 0; col < width && !cancel; col++)
+                {
+                    for (int i = 0; i < n; i++)
+                    {
+                        coord[2 * i] = bodies[i].coord[0];
+                        coord[2 * i + 1] = bodies[i].coord[1];
+                        veloc[2 * i] = bodies[i].veloc[0];
+                        veloc[2 * i + 1] = bodies[i].veloc[1];
+                    }
+                    // Row 0 is the top of the image, i.e. the largest y.
+                    coord[2 * varied] = xMin + (xMax - xMin) * (col + 0.5) / width;
+                    coord[2 * varied + 1] = yMax - (yMax - yMin) * (row + 0.5) / height;
+                    exponents[row * width + col] = exponent(coord, veloc);
+                }
+            } });
+    }
+
+    float StabilityMap::exponent(std::vector<double> &coord, std::vector<double> &veloc) const
+    {
+        const int renormInterval = 16;
+        std::vector<double> tangent(4 * n, 0.0), accel(2 * n), tangentAccel(2 * n);
+        double norm = 0.0;
+        for (int i = 0; i < movable; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                tangent[4 * i + j] = 1.0;
+                norm += 1.0;
+            }
+        }
+        norm = sqrt(norm);
+        for (int i = 0; i < 4 * n; i++)
+        {
+            tangent[i] /= norm;
+        }
+
+        // tangent holds (dx, dy, dvx, dvy) per body; acceleration() reads the
+        // position part through a stride-4 view.
+        double logGrowth = 0.0;
+        int steps = duration / deltaTime;
+        acceleration(coord, tangent, accel, tangentAccel);
+        for (int s = 1; s <= steps; s++)
+        {
+            for (int i = 0; i < movable; i++)
+            {
+                for (int j = 0; j < 2; j++)
+                {
+                    veloc[2 * i + j] += 0.5 * deltaTime * accel[2 * i + j];
+                    coord[2 * i + j] += deltaTime * veloc[2 * i + j];
+                    tangent[4 * i + 2 + j] += 0.5 * deltaTime * tangentAccel[2 * i + j];
+                    tangent[4 * i + j] += deltaTime * tangent[4 * i + 2 + j];
+                }
+            }
+            acceleration(coord, tangent, accel, tangentAccel);
+            for (int i = 0; i < movable; i++)
+            {
+                for (int j = 0; j < 2; j++)
+                {
+                    veloc[2 * i + j] += 0.5 * deltaTime * accel[2 * i + j];
+                    tangent[4 * i + 2 + j] += 0.5 * deltaTime * tangentAccel[2 * i + j];
+                }
+            }
+
+            if (s % renormInterval == 0 || s == steps)
+            {
+                norm = 0.0;
+                for (int i = 0; i < 4 * n; i++)
+                {
+                    norm += tangent[i] * tangent[i];
+                }
+                norm = sqrt(norm);
+                if (!std::isfinite(norm) || norm == 0.0)
+                {
+                    return std::numeric_limits<float>::quiet_NaN();
+                }
+                logGrowth += log(norm);
+                for (int i = 0; i < 4 * n; i++)
+                {
+                    tangent[i] /= norm;
+                }
+            }
+        }
+        return logGrowth / (steps * deltaTime);
+    }
+
+    void StabilityMap::acceleration(const std::vector<double> &coord, const std::vector<double> &tangent,
+                                    std::vector<double> &accel, std::vector<double> &tangentAccel) const
+    {
+        std::fill(accel.begin(), accel.end(), 0.0);
+        std::fill(tangentAccel.begin(), tangentAccel.end(), 0.0);
+        for (int i = 0; i < movable; i++)
+        {
+            for (int k = 0; k < n; k++)
+            {
+                if (k == i)
+                {
+                    continue;
+                }
+                double dx = coord[2 * k] - coord[2 * i];
+                double dy = coord[2 * k + 1] - coord[2 * i + 1];
+                double distSqr = dx * dx + dy * dy + alphaSqr;
+                double invDist = 1.0 / sqrt(distSqr);
+                double invDist3 = invDist * invDist * invDist;
+                double gm = G * mass[k];
+                accel[2 * i] += gm * dx * invDist3;
+                accel[2 * i + 1] += gm * dy * invDist3;
+
+                // d/dx of m d / r^3: (delta - 3 (d . delta) d / r^2) / r^3
+                double ddx = tangent[4 * k] - tangent[4 * i];
+                double ddy = tangent[4 * k + 1] - tangent[4 * i + 1];
+                double proj = 3.0 * (dx * ddx + dy * ddy) / distSqr;
+                tangentAccel[2 * i] += gm * (ddx - proj * dx) * invDist3;
+                tangentAccel[2 * i + 1] += gm * (ddy - proj * dy) * invDist3;
+            }
+        }
+    }
+
+    bool StabilityMap::writeImage(const std::string &path) const
+    {
+        float lo = std::numeric_limits<float>::max(), hi = -lo;
+        for (int i = 0; i < exponents.size(); i++)
+        {
+            if (std::isfinite(exponents[i]))
+            {
+                lo = std::min(lo, exponents[i]);
+                hi = std::max(hi, exponents[i]);
+            }
+        }
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+        file << "P6\n"
+             << width << ' ' << height << "\n255\n";
+        for (int i = 0; i < exponents.size(); i++)
+        {
+            unsigned char rgb[3] = {0, 0, 0};
+            if (std::isfinite(exponents[i]))
+            {
+                float t = hi > lo ? (exponents[i] - lo) / (hi - lo) : 0.0f;
+                rgb[0] = 255 * t;
+                rgb[1] = 255 * (1.0f - fabs(2.0f * t - 1.0f));
+                rgb[2] = 255 * (1.0f - t);
+            }
+            file.write((const char *)rgb, 3);
+        }
+        return (bool)file;
+    }
+
+    bool StabilityMap::writeRaw(const std::string &path) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+        int size[2] = {width, height};
+        file.write((const char *)size, sizeof(size));
+        file.write((const char *)exponents.data(), exponents.size() * sizeof(float));
+        return (bool)file;
+    }
+}
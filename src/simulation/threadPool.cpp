@@ -0,0 +1,122 @@
+#include "simulation/threadPool.hpp"
+#include "simulation/trace.hpp"
+
+namespace sim
+{
+    ThreadPool::ThreadPool()
+    {
+        start(std::thread::hardware_concurrency());
+    }
+
+    ThreadPool::ThreadPool(int numThreads)
+    {
+        start(numThreads);
+    }
+
+    void ThreadPool::start(int numThreads)
+    {
+        task = nullptr;
+        count = 0;
+        chunkSize = 1;
+        nextChunk = 0;
+        busy = 0;
+        generation = 0;
+        stop = false;
+        for (int i = 1; i < numThreads; i++)
+        {
+            workers.emplace_back(&ThreadPool::worker, this);
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (int i = 0; i < workers.size(); i++)
+        {
+            workers[i].join();
+        }
+    }
+
+    int ThreadPool::size() const
+    {
+        return workers.size() + 1;
+    }
+
+    void ThreadPool::parallelFor(int count, const std::function<void(int begin, int end)> &task)
+    {
+        if (count <= 0)
+        {
+            return;
+        }
+        if (workers.empty() || count == 1)
+        {
+            task(0, count);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->task = &task;
+            this->count = count;
+            chunkSize = std::max(1, count / (4 * size()));
+            nextChunk = 0;
+            busy = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        {
+            TraceScope trace("parallelFor");
+            runChunks();
+        }
+
+        TraceScope trace("parallelFor wait");
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]
+                  { return busy == 0; });
+        this->task = nullptr;
+    }
+
+    void ThreadPool::worker()
+    {
+        unsigned long long seen = 0;
+        traceThreadName("Pool worker");
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seen]
+                          { return stop || generation != seen; });
+                if (stop)
+                {
+                    return;
+                }
+                seen = generation;
+            }
+            {
+                TraceScope trace("parallelFor");
+                runChunks();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busy--;
+            }
+            done.notify_one();
+        }
+    }
+
+    void ThreadPool::runChunks()
+    {
+        while (true)
+        {
+            int begin = nextChunk.fetch_add(chunkSize);
+            if (begin >= count)
+            {
+                return;
+            }
+            (*task)(begin, std::min(count, begin + chunkSize));
+        }
+    }
+}
@@ -0,0 +1,195 @@
+#include "simulation/trace.hpp"
+#include "simulation/replaceFile.hpp"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+namespace sim
+{
+    namespace
+    {
+        // Fields are relaxed atomics so a dump may read a record while its
+        // thread overwrites it. sequence holds the event index the record was
+        // written for, and is invalidated while the record is being replaced.
+        struct TraceRecord
+        {
+            std::atomic<const char *> name;
+            std::atomic<uint64_t> start, duration;
+            std::atomic<uint64_t> sequence;
+        };
+
+        const uint64_t bufferCapacity = 1 << 16;
+        const uint64_t invalidSequence = ~0ull;
+
+        struct ThreadBuffer
+        {
+            int tid;
+            std::atomic<const char *> name;
+            std::unique_ptr<TraceRecord[]> records;
+            std::atomic<uint64_t> written;
+        };
+
+        struct Registry
+        {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+            std::vector<ThreadBuffer *> freeBuffers;
+            int nextTid = 1;
+        };
+
+        // Never destroyed, so threads that exit during static destruction can
+        // still hand their buffers back.
+        Registry &registry()
+        {
+            static Registry *instance = new Registry();
+            return *instance;
+        }
+
+        // Returns the thread's buffer to the free list when the thread exits,
+        // so short-lived pools reuse the same rings instead of adding new ones.
+        struct BufferOwner
+        {
+            ThreadBuffer *buffer = nullptr;
+
+            ~BufferOwner()
+            {
+                if (buffer != nullptr)
+                {
+                    Registry &reg = registry();
+                    std::lock_guard<std::mutex> lock(reg.mutex);
+                    reg.freeBuffers.push_back(buffer);
+                }
+            }
+        };
+
+        const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        thread_local BufferOwner owner;
+
+        ThreadBuffer &threadBuffer()
+        {
+            if (owner.buffer == nullptr)
+            {
+                Registry &reg = registry();
+                std::lock_guard<std::mutex> lock(reg.mutex);
+                ThreadBuffer *buffer;
+                if (!reg.freeBuffers.empty())
+                {
+                    buffer = reg.freeBuffers.back();
+                    reg.freeBuffers.pop_back();
+                }
+                else
+                {
+                    reg.buffers.emplace_back(new ThreadBuffer());
+                    buffer = reg.buffers.back().get();
+                    buffer->records.reset(new TraceRecord[bufferCapacity]);
+                }
+                // A reused ring starts empty under a new track, so the events of
+                // the thread that exited are not shown as this one's.
+                for (uint64_t i = 0; i < bufferCapacity; i++)
+                {
+                    buffer->records[i].sequence.store(invalidSequence, std::memory_order_relaxed);
+                }
+                buffer->tid = reg.nextTid++;
+                buffer->name.store(nullptr, std::memory_order_relaxed);
+                buffer->written.store(0, std::memory_order_relaxed);
+                owner.buffer = buffer;
+            }
+            return *owner.buffer;
+        }
+    }
+
+    uint64_t traceNow()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void traceEvent(const char *name, uint64_t start, uint64_t end)
+    {
+        ThreadBuffer &buffer = threadBuffer();
+        uint64_t index = buffer.written.load(std::memory_order_relaxed);
+        TraceRecord &record = buffer.records[index % bufferCapacity];
+        record.sequence.store(invalidSequence, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        record.name.store(name, std::memory_order_relaxed);
+        record.start.store(start, std::memory_order_relaxed);
+        record.duration.store(end - start, std::memory_order_relaxed);
+        record.sequence.store(index, std::memory_order_release);
+        buffer.written.store(index + 1, std::memory_order_release);
+    }
+
+    void traceThreadName(const char *name)
+    {
+        threadBuffer().name.store(name, std::memory_order_relaxed);
+    }
+
+    bool dumpTrace(const std::string &path, std::string &error)
+    {
+        std::string tmpPath = path + ".tmp";
+        FILE *file = fopen(tmpPath.c_str(), "w");
+        if (file == nullptr)
+        {
+            error = "cannot open " + tmpPath;
+            return false;
+        }
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool first = true;
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (const std::unique_ptr<ThreadBuffer> &buffer : reg.buffers)
+        {
+            const char *threadName = buffer->name.load(std::memory_order_relaxed);
+            if (threadName != nullptr)
+            {
+                fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                        first ? "" : ",\n", buffer->tid, threadName);
+                first = false;
+            }
+            // Other threads keep recording during the dump. A record is only
+            // used if its sequence number matches before and after reading it;
+            // otherwise it was overwritten meanwhile and is skipped.
+            uint64_t written = buffer->written.load(std::memory_order_acquire);
+            uint64_t begin = written > bufferCapacity ? written - bufferCapacity : 0;
+            for (uint64_t i = begin; i < written; i++)
+            {
+                const TraceRecord &record = buffer->records[i % bufferCapacity];
+                if (record.sequence.load(std::memory_order_acquire) != i)
+                {
+                    continue;
+                }
+                const char *name = record.name.load(std::memory_order_relaxed);
+                uint64_t start = record.start.load(std::memory_order_relaxed);
+                uint64_t duration = record.duration.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (record.sequence.load(std::memory_order_relaxed) != i)
+                {
+                    continue;
+                }
+                fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        first ? "" : ",\n", name, buffer->tid, start / 1000.0, duration / 1000.0);
+                first = false;
+            }
+        }
+        fprintf(file, "\n]}\n");
+        bool ok = fflush(file) == 0;
+        ok = fclose(file) == 0 && ok;
+        if (!ok || !replaceFile(tmpPath, path))
+        {
+            error = "cannot write " + path;
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    TraceScope::TraceScope(const char *name) : name(name), start(traceNow())
+    {
+    }
+
+    TraceScope::~TraceScope()
+    {
+        traceEvent(name, start, traceNow());
+    }
+}
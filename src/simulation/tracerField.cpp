@@ -0,0 +1,130 @@
+#include "simulation/tracerField.hpp"
+
+namespace sim
+{
+    namespace
+    {
+        const double pi = 3.14159265358979323846;
+    }
+
+    TracerField::TracerField(ThreadPool &pool) : pool(pool)
+    {
+    }
+
+    int TracerField::size() const
+    {
+        return x.size();
+    }
+
+    void TracerField::clear()
+    {
+        x.clear();
+        y.clear();
+        vx.clear();
+        vy.clear();
+    }
+
+    void TracerField::seedDisk(const std::vector<Body> &sources, int count, float innerRadius, float outerRadius, float G, unsigned int seed)
+    {
+        float totalMass = 0, cx = 0, cy = 0, cvx = 0, cvy = 0;
+        for (int i = 0; i < sources.size(); i++)
+        {
+            totalMass += sources[i].mass;
+            cx += sources[i].mass * sources[i].coord[0];
+            cy += sources[i].mass * sources[i].coord[1];
+            cvx += sources[i].mass * sources[i].veloc[0];
+            cvy += sources[i].mass * sources[i].veloc[1];
+        }
+        cx /= totalMass;
+        cy /= totalMass;
+        cvx /= totalMass;
+        cvy /= totalMass;
+
+        x.resize(count);
+        y.resize(count);
+        vx.resize(count);
+        vy.resize(count);
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        for (int i = 0; i < count; i++)
+        {
+            // Uniform in area between the two radii, on circular orbits around
+            // the sources' centre of mass.
+            float u = uniform(rng);
+            float r = sqrt(innerRadius * innerRadius + u * (outerRadius * outerRadius - innerRadius * innerRadius));
+            float phi = 2.0f * pi * uniform(rng);
+            float v = sqrt(G * totalMass / r);
+            x[i] = cx + r * cos(phi);
+            y[i] = cy + r * sin(phi);
+            vx[i] = cvx - v * sin(phi);
+            vy[i] = cvy + v * cos(phi);
+        }
+    }
+
+    void TracerField::step(const std::vector<Body> &sources, float G, float alpha, float deltaTime)
+    {
+        sourceX.resize(sources.size());
+        sourceY.resize(sources.size());
+        sourceGM.resize(sources.size());
+        for (int i = 0; i < sources.size(); i++)
+        {
+            sourceX[i] = sources[i].coord[0];
+            sourceY[i] = sources[i].coord[1];
+            sourceGM[i] = G * sources[i].mass;
+        }
+
+        int numBlocks = (size() + blockSize - 1) / blockSize;
+        float alphaSqr = alpha * alpha;
+        pool.parallelFor(numBlocks, [&](int begin, int end)
+                         {
+            for (int b = begin; b < end; b++)
+            {
+                stepBlock(b * blockSize, std::min(size(), (b + 1) * blockSize), alphaSqr, deltaTime);
+            } });
+    }
+
+    void TracerField::stepBlock(int begin, int end, float alphaSqr, float deltaTime)
+    {
+        int n = end - begin;
+        float *__restrict px = x.data() + begin;
+        float *__restrict py = y.data() + begin;
+        float *__restrict pvx = vx.data() + begin;
+        float *__restrict pvy = vy.data() + begin;
+        float ax[blockSize], ay[blockSize];
+        for (int t = 0; t < n; t++)
+        {
+            ax[t] = 0.0f;
+            ay[t] = 0.0f;
+        }
+        for (int s = 0; s < sourceGM.size(); s++)
+        {
+            float sx = sourceX[s], sy = sourceY[s], gm = sourceGM[s];
+            for (int t = 0; t < n; t++)
+            {
+                float dx = sx - px[t];
+                float dy = sy - py[t];
+                float distSqr = dx * dx + dy * dy + alphaSqr;
+                float invDist = 1.0f / sqrtf(distSqr);
+                float invDist3 = invDist * invDist * invDist;
+                ax[t] += gm * dx * invDist3;
+                ay[t] += gm * dy * invDist3;
+            }
+        }
+        for (int t = 0; t < n; t++)
+        {
+            pvx[t] += ax[t] * deltaTime;
+            pvy[t] += ay[t] * deltaTime;
+            px[t] += pvx[t] * deltaTime;
+            py[t] += pvy[t] * deltaTime;
+        }
+    }
+
+    void TracerField::writePositions(float *out, float scale) const
+    {
+        for (int i = 0; i < size(); i++)
+        {
+            out[2 * i] = x[i] * scale;
+            out[2 * i + 1] = y[i] * scale;
+        }
+    }
+}
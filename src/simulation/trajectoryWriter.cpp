@@ -0,0 +1,266 @@
+#include "simulation/trajectoryWriter.hpp"
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+
+namespace sim
+{
+    namespace
+    {
+        const char trajectoryMagic[8] = {'N', 'B', 'T', 'R', 'A', 'J', '\r', '\n'};
+        const uint32_t trajectoryVersion = 1;
+
+        struct ChunkHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t dimension;
+        };
+
+        struct FrameHeader
+        {
+            uint64_t step;
+            uint32_t count;
+            uint32_t reserved;
+        };
+    }
+
+    TrajectoryWriter::TrajectoryWriter(ThreadPool &pool)
+        : pool(pool), head(0), tail(0), running(false), failed(false), policy(Policy::Drop), dimension(0),
+          framesPerChunk(0), chunkFrames(0), chunkIndex(0), file(nullptr),
+          framesWritten(0), framesDropped(0), bytesWritten(0)
+    {
+    }
+
+    TrajectoryWriter::~TrajectoryWriter()
+    {
+        stop();
+    }
+
+    bool TrajectoryWriter::start(const std::string &prefix, int dimension, int numOfBodies, int numBuffers, int framesPerChunk, Policy policy)
+    {
+        stop();
+        this->prefix = prefix;
+        this->dimension = dimension;
+        this->framesPerChunk = std::max(framesPerChunk, 1);
+        this->policy = policy;
+        ring.assign(std::max(numBuffers, 2), Frame());
+        for (Frame &frame : ring)
+        {
+            frame.data.reserve((size_t)numOfBodies * dimension * 2);
+        }
+        full.assign(ring.size(), false);
+        head = 0;
+        tail = 0;
+        chunkFrames = 0;
+        chunkIndex = 0;
+        framesWritten = 0;
+        framesDropped = 0;
+        bytesWritten = 0;
+        failed = false;
+        error.clear();
+        if (!openChunk())
+        {
+            failed = true;
+            return false;
+        }
+        running = true;
+        thread = std::thread(&TrajectoryWriter::writer, this);
+        return true;
+    }
+
+    bool TrajectoryWriter::record(const std::vector<Body> &bodies, unsigned long long step)
+    {
+        if (!running)
+        {
+            return false;
+        }
+        int slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (full[head])
+            {
+                if (policy == Policy::Drop)
+                {
+                    framesDropped++;
+                    return false;
+                }
+                freed.wait(lock, [&]
+                           { return !full[head] || !running; });
+                if (!running)
+                {
+                    return false;
+                }
+            }
+            slot = head;
+        }
+
+        // The slot is not full, so the writer thread will not touch it until
+        // it is published below.
+        Frame &frame = ring[slot];
+        int n = bodies.size();
+        frame.step = step;
+        frame.count = n;
+        frame.data.resize((size_t)n * dimension * 2);
+        float *coord = frame.data.data();
+        float *veloc = coord + (size_t)n * dimension;
+        int dim = dimension;
+        pool.parallelFor(n, [&](int begin, int end)
+                         {
+            for (int j = 0; j < dim; j++)
+            {
+                for (int i = begin; i < end; i++)
+                {
+                    coord[(size_t)j * n + i] = bodies[i].coord[j];
+                    veloc[(size_t)j * n + i] = bodies[i].veloc[j];
+                }
+            } });
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            full[slot] = true;
+            head = (head + 1) % ring.size();
+        }
+        filled.notify_one();
+        return true;
+    }
+
+    void TrajectoryWriter::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        // After a write error the writer thread has already left on its own,
+        // but it still has to be joined.
+        filled.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        if (file != nullptr)
+        {
+            fclose(file);
+            file = nullptr;
+        }
+        failed = false;
+    }
+
+    bool TrajectoryWriter::isRecording() const
+    {
+        return running;
+    }
+
+    bool TrajectoryWriter::hasFailed() const
+    {
+        return failed;
+    }
+
+    std::string TrajectoryWriter::getError()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return error;
+    }
+
+    unsigned long long TrajectoryWriter::getFramesWritten() const
+    {
+        return framesWritten;
+    }
+
+    unsigned long long TrajectoryWriter::getFramesDropped() const
+    {
+        return framesDropped;
+    }
+
+    unsigned long long TrajectoryWriter::getBytesWritten() const
+    {
+        return bytesWritten;
+    }
+
+    bool TrajectoryWriter::openChunk()
+    {
+        if (file != nullptr)
+        {
+            bool closed = fclose(file) == 0;
+            file = nullptr;
+            if (!closed)
+            {
+                fail("Failed to close chunk " + std::to_string(chunkIndex - 1));
+                return false;
+            }
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "_%05d.traj", chunkIndex++);
+        file = fopen((prefix + name).c_str(), "wb");
+        if (file == nullptr)
+        {
+            fail("Failed to open " + prefix + name);
+            return false;
+        }
+        ChunkHeader header;
+        memcpy(header.magic, trajectoryMagic, sizeof(trajectoryMagic));
+        header.version = trajectoryVersion;
+        header.dimension = dimension;
+        if (fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            fail("Failed to write " + prefix + name);
+            return false;
+        }
+        bytesWritten += sizeof(header);
+        chunkFrames = 0;
+        return true;
+    }
+
+    void TrajectoryWriter::fail(const std::string &message)
+    {
+        std::cerr << message << ", recording stopped" << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = message;
+            failed = true;
+            running = false;
+        }
+        freed.notify_all();
+    }
+
+    void TrajectoryWriter::writer()
+    {
+        while (true)
+        {
+            int slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                filled.wait(lock, [&]
+                            { return full[tail] || !running; });
+                if (!full[tail])
+                {
+                    return;
+                }
+                slot = tail;
+            }
+
+            Frame &frame = ring[slot];
+            if (chunkFrames == framesPerChunk && !openChunk())
+            {
+                return;
+            }
+            FrameHeader header = {frame.step, (uint32_t)frame.count, 0};
+            if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+                fwrite(frame.data.data(), sizeof(float), frame.data.size(), file) != frame.data.size())
+            {
+                fail("Failed to write frame " + std::to_string(frame.step) + " to chunk " + std::to_string(chunkIndex - 1));
+                return;
+            }
+            bytesWritten += sizeof(header) + frame.data.size() * sizeof(float);
+            framesWritten++;
+            chunkFrames++;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                full[slot] = false;
+                tail = (tail + 1) % ring.size();
+            }
+            freed.notify_one();
+        }
+    }
+}